@@ -1,61 +1,235 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <limits.h>
 
 
-#define PARTITION_SIZE 256 * 1024
-#define BLOCK_SIZE 4 * 1024
+#define PARTITION_SIZE (256 * 1024)   // 기본 파티션 크기
+#define INODE_COUNT 80                // 기본 inode 수
+#define BLOCK_SIZE (4 * 1024)
+#define NAME_MAX_LEN 255
+#define INODE_EXTENTS 30
+#define OVERFLOW_EXTENTS (BLOCK_SIZE / (int)sizeof(Extent))
+#define KU_FS_MAGIC 0x5346554b        // "KUFS"
+#define IO_CHUNK (16 * BLOCK_SIZE)      // 트레이스 명령이 한 번에 옮기는 크기
+
+// 연속된 data 블럭 구간
+typedef struct _Extent {
+    unsigned int start;
+    unsigned int len;
+} Extent;
 
 typedef struct _Inode {
     unsigned int fsize;
     unsigned int blocks;
-    unsigned int pointer[12];
-    char __dummy__[200];
+    unsigned int extents;   // 사용 중인 익스텐트 수
+    unsigned int overflow;  // 넘치는 익스텐트를 담는 data 블럭, 0이면 없음 (0번은 루트 디렉토리)
+    Extent extent[INODE_EXTENTS];
 } Inode;
 
-int ku_fs_init();
+// 파티션 구조 (블럭 단위)
+typedef struct _Geometry {
+    unsigned int partition_size;
+    unsigned int inode_count;
+    unsigned int data_count;
+    unsigned int inode_bitmap_start;
+    unsigned int data_bitmap_start;
+    unsigned int inode_table_start;
+    unsigned int data_start;
+} Geometry;
+
+// 0번 블럭에 저장
+typedef struct _Superblock {
+    unsigned int magic;
+    unsigned int block_size;
+    unsigned int root_inum;
+    Geometry geo;
+} Superblock;
+
+// 가변 길이 디렉토리 엔트리 (블럭 경계를 넘지 않음)
+typedef struct _Dirent {
+    unsigned int inum;      // 0이면 빈 엔트리
+    unsigned short rec_len; // 다음 엔트리까지의 거리
+    unsigned char name_len;
+    unsigned char __pad__;
+    char name[];
+} Dirent;
+
+#define DIRENT_SIZE(len) ((sizeof(Dirent) + (len) + 3) & ~3)
+
+// 비트맵 할당기 (next-fit)
+typedef struct _Bitmap {
+    char* map;
+    int nbits;  // 파티션 구조에서 정해지는 비트 수
+    int hint;   // 다음 탐색 시작 위치
+} Bitmap;
+
+// 이름 -> 디렉토리 엔트리 오프셋 해시 인덱스 (open addressing)
+typedef struct _DirSlot {
+    unsigned int hash;
+    int off;    // -1이면 빈 슬롯
+} DirSlot;
+
+int ku_fs_layout(unsigned int partition_size, unsigned int inode_count);
+int ku_fs_format();
+void ku_fs_attach();
+int inode_check(Inode* inode);
+int ku_fs_init(unsigned int partition_size, unsigned int inode_count);
+int ku_fs_mkfs(char* path, unsigned int partition_size, unsigned int inode_count);
+int ku_fs_mount(char* path);
+void mark_dirty(void* addr, unsigned int len);
+int ku_fs_sync();
+int ku_fs_export(char* path);
+int ku_fs_export_diff(char* path);
+void ku_fs_dump_hex();
+Inode* get_inode(unsigned int inum);
+char* get_data_block(unsigned int blk);
+Extent* inode_extent(Inode* inode, unsigned int i);
+int inode_append(Inode* inode, unsigned int start, unsigned int len);
+int inode_grow(Inode* inode, unsigned int blocks);
+void inode_shrink(Inode* inode, unsigned int blocks);
+void inode_copy(Inode* inode, unsigned int pos, char* buf, unsigned int len, int to_file);
+int ku_fs_lookup(char* file_name);
+long ku_fs_pwritev(unsigned int inum, const struct iovec* iov, int iovcnt, unsigned int offset);
+long ku_fs_preadv(unsigned int inum, const struct iovec* iov, int iovcnt, unsigned int offset);
+long ku_fs_pwrite(unsigned int inum, const void* buf, unsigned int count, unsigned int offset);
+long ku_fs_pread(unsigned int inum, void* buf, unsigned int count, unsigned int offset);
 void set_bitmap(char* bitmap, int inode_num);
 void clear_bitmap(char* bitmap, int inode_num);
 int is_mapped_inum(char* bitmap, int inode_num);
-int find_free_bitmap_idx(char* bitmap);
+unsigned long long bitmap_word(char* map, int w);
+int bitmap_scan(Bitmap* bm, int start, int end, int val);
+int bitmap_alloc(Bitmap* bm);
+int bitmap_alloc_run(Bitmap* bm, int n);
+int bitmap_alloc_at(Bitmap* bm, int start, int n);
 int write_file(char* file_name, unsigned int byte);
 int read_file(char* file_name, unsigned int byte);
 int delete_file(char* file_name);
+Dirent* dir_entry(int off);
+unsigned int dir_hash(char* name, int len);
+int dir_index_grow(unsigned int new_cap);
+int dir_index_add(unsigned int hash, int off);
+int dir_index_find(char* file_name, int len, unsigned int hash);
+int dir_blocks_push(unsigned int blk, int nblocks);
+int dir_index_build();
+int dir_index_load();
+int dir_lookup(char* file_name);
+int dir_block_fit(int b, int need);
+int dir_insert(char* file_name, int inum);
+void dir_remove(int off);
 
 void* partition;    // 초기화된 파일 시스템 위치
+Geometry geo;       // 파티션 구조
+int image_fd = -1;  // mmap한 이미지 파일, 메모리 파티션이면 -1
+unsigned char* dirty_blocks;    // sync 이후 바뀐 블럭
+unsigned int dirty_lo;          // 바뀐 블럭 구간 [dirty_lo, dirty_hi)
+unsigned int dirty_hi;
 char* inode_bitmap; // inode 비트맵 위치
 char* data_bitmap;  // data 비트맵 위치
+Bitmap inode_alloc; // inode 할당기
+Bitmap data_alloc;  // data 블럭 할당기
 Inode* root_inode;  // 루트 inode
 char* root_data_block;  // 루트 inode 데이터가 저장된 위치
+DirSlot* dir_index;     // 디렉토리 해시 인덱스
+unsigned int dir_index_cap;
+unsigned int dir_index_cnt;
+unsigned short* dir_slack;  // 디렉토리 블럭별 최대 빈 공간 (상한값)
+unsigned int* dir_blocks;   // 디렉토리 논리 블럭 -> data 블럭
+unsigned int dir_blocks_cap;
+int dir_index_ready;        // 첫 디렉토리 접근 때 인덱스 구성
 
 
 int main(int argc, char** argv) {
+    // ku_fs <input> [partition_size inode_count] [--mkfs=IMG | --mount=IMG] [--export=FILE] [--diff=FILE] [--hex]
+    char* args[3];
+    int nargs = 0;
+    char* mkfs_path = NULL;
+    char* mount_path = NULL;
+    char* export_path = NULL;
+    char* diff_path = NULL;
+    int hex = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--mkfs=", 7) == 0) {
+            mkfs_path = argv[i] + 7;
+        }
+        else if (strncmp(argv[i], "--mount=", 8) == 0) {
+            mount_path = argv[i] + 8;
+        }
+        else if (strncmp(argv[i], "--export=", 9) == 0) {
+            export_path = argv[i] + 9;
+        }
+        else if (strncmp(argv[i], "--diff=", 7) == 0) {
+            diff_path = argv[i] + 7;
+        }
+        else if (strcmp(argv[i], "--hex") == 0) {
+            hex = 1;
+        }
+        else if (nargs < 3 && strncmp(argv[i], "--", 2) != 0) {
+            args[nargs++] = argv[i];
+        }
+        else {
+            nargs = -1;
+            break;
+        }
+    }
     
-    if (argc != 2) {
+    if ((nargs != 1 && nargs != 3) || (mkfs_path && mount_path) || (mount_path && nargs == 3)) {
         printf("ku_fs: Wrong number of arguments\n");
 		return 1;
     }
 
     FILE* fd=NULL;
-    char buffer[100];
-    fd = fopen(argv[1], "r");
+    char buffer[NAME_MAX_LEN + 32];
+    fd = fopen(args[0], "r");
 
 	if(!fd){
 		printf("ku_fs: Fail to open the input file\n");
 		return 1;
 	}
 
-    int init = ku_fs_init();
-    if (init) {
-        printf("ku_fs: Fail to allocate new file system\n");
-        return 1;
+    unsigned int partition_size = PARTITION_SIZE;
+    unsigned int inode_count = INODE_COUNT;
+    if (nargs == 3) {
+        char* end1;
+        char* end2;
+        unsigned long size_arg = strtoul(args[1], &end1, 0);
+        unsigned long count_arg = strtoul(args[2], &end2, 0);
+        // unsigned int를 넘는 값이나 inode 테이블이 들어가지 않는 구조는 거부
+        if (*end1 || *end2 || args[1][0] == '-' || args[2][0] == '-' ||
+                size_arg > UINT_MAX || count_arg > UINT_MAX ||
+                ku_fs_layout(size_arg, count_arg)) {
+            printf("ku_fs: Invalid partition_size or inode_count\n");
+            return 1;
+        }
+        partition_size = size_arg;
+        inode_count = count_arg;
+    }
+
+    if (mount_path) {
+        if (ku_fs_mount(mount_path)) {
+            printf("ku_fs: Fail to mount the image\n");
+            return 1;
+        }
+    }
+    else {
+        int init = mkfs_path ? ku_fs_mkfs(mkfs_path, partition_size, inode_count)
+                             : ku_fs_init(partition_size, inode_count);
+        if (init) {
+            printf("ku_fs: Fail to allocate new file system\n");
+            return 1;
+        }
     }
 
     while (fgets(buffer, sizeof(buffer), fd) != NULL) {
         char* tok = strtok(buffer, " ");
-        char title[3];
+        char* title = tok;
         unsigned int byte = 0;
-        strcpy(title, tok);
         tok = strtok(NULL, " ");
         char mode = *tok;
         if (mode != 'd') {
@@ -74,46 +248,337 @@ int main(int argc, char** argv) {
 
     }
     // eof
-    for (int i = 0; i < 4096*64; i++) {
-        printf("%.2x ", *((unsigned char*)partition + i));        
+    // diff는 sync 전에 (sync가 변경 기록을 지움)
+    if (diff_path && ku_fs_export_diff(diff_path)) {
+        printf("ku_fs: Fail to export the diff\n");
+    }
+    if (ku_fs_sync()) {
+        printf("ku_fs: Fail to sync the image\n");
+    }
+    if (export_path && ku_fs_export(export_path)) {
+        printf("ku_fs: Fail to export the image\n");
+    }
+    if (hex) {
+        ku_fs_dump_hex();
     }
 
     return 0;
 }
 
-int ku_fs_init() {
-    // 256KB 파티션 생성
-    partition = calloc(1, PARTITION_SIZE);
-    inode_bitmap = &partition[BLOCK_SIZE];
-    data_bitmap = &partition[2*BLOCK_SIZE];
+// 0번 블럭은 슈퍼블럭, 그 뒤로 inode 비트맵, data 비트맵, inode 테이블, data 블럭 순서
+int ku_fs_layout(unsigned int partition_size, unsigned int inode_count) {
+    unsigned int total = partition_size / BLOCK_SIZE;
+    unsigned int bits_per_block = BLOCK_SIZE * 8;
+    // inode 수가 커도 넘치지 않도록 64비트로 계산
+    unsigned long long inode_bitmap_blocks = ((unsigned long long)inode_count + bits_per_block - 1) / bits_per_block;
+    unsigned long long inode_table_blocks = ((unsigned long long)inode_count * sizeof(Inode) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    unsigned long long meta = 1 + inode_bitmap_blocks + inode_table_blocks;
+    if (inode_count < 3 || total <= meta + 1) {
+        return -1;
+    }
+    // data 비트맵 블럭 1개가 data 블럭 bits_per_block개를 담당
+    unsigned int data_bitmap_blocks = (total - meta + bits_per_block) / (bits_per_block + 1);
+
+    geo.partition_size = total * BLOCK_SIZE;
+    geo.inode_count = inode_count;
+    geo.inode_bitmap_start = 1;
+    geo.data_bitmap_start = geo.inode_bitmap_start + inode_bitmap_blocks;
+    geo.inode_table_start = geo.data_bitmap_start + data_bitmap_blocks;
+    geo.data_start = geo.inode_table_start + inode_table_blocks;
+    geo.data_count = total - geo.data_start;
+    return 0;
+}
+
+// geo에 맞춰 비트맵, 할당기, 변경 기록 준비
+void ku_fs_attach() {
+    inode_bitmap = &partition[geo.inode_bitmap_start * BLOCK_SIZE];
+    data_bitmap = &partition[geo.data_bitmap_start * BLOCK_SIZE];
+
+    inode_alloc.map = inode_bitmap;
+    inode_alloc.nbits = geo.inode_count;
+    inode_alloc.hint = 0;
+    data_alloc.map = data_bitmap;
+    data_alloc.nbits = geo.data_count;
+    data_alloc.hint = 0;
+
+    free(dirty_blocks);
+    dirty_blocks = calloc(1, geo.partition_size / BLOCK_SIZE);
+    dirty_lo = geo.partition_size / BLOCK_SIZE;
+    dirty_hi = 0;
+    dir_index_ready = 0;
+}
+
+// 0으로 채워진 파티션에 슈퍼블럭과 루트 디렉토리 기록
+int ku_fs_format() {
+    ku_fs_attach();
+    if (!dirty_blocks) {
+        return -1;
+    }
 
     set_bitmap(inode_bitmap, 0);
     set_bitmap(inode_bitmap, 1); // not used
 
     //루트 디렉토리 초기화
-    int inode_idx = find_free_bitmap_idx(inode_bitmap);
+    int inode_idx = bitmap_alloc(&inode_alloc);
     if (inode_idx == -1) {
         return -1;
     }
-    set_bitmap(inode_bitmap, inode_idx);
-
-    // inode offset
-    unsigned int root_inode_offset = inode_idx * sizeof(Inode) + 3 * BLOCK_SIZE;
 
-    root_inode = (partition + root_inode_offset);
-    root_inode->fsize = 4 * 80;
-    root_inode->blocks = 1;
+    root_inode = get_inode(inode_idx);
+    root_inode->fsize = BLOCK_SIZE;
 
-    int data_block_idx = find_free_bitmap_idx(data_bitmap);
+    int data_block_idx = bitmap_alloc(&data_alloc);
     if (data_block_idx == -1) {
         return -1;
     }
-    set_bitmap(data_bitmap, data_block_idx);
-    root_inode->pointer[0] = data_block_idx;
+    inode_append(root_inode, data_block_idx, 1);
+
+    root_data_block = get_data_block(data_block_idx); // 루트 디렉토리 데이터 블럭 실제 위치
+
+    // 블럭 전체를 하나의 빈 엔트리로
+    Dirent* first = (Dirent*)root_data_block;
+    first->inum = 0;
+    first->rec_len = BLOCK_SIZE;
+    mark_dirty(first, sizeof(Dirent));
+
+    Superblock* sb = (Superblock*)partition;
+    sb->magic = KU_FS_MAGIC;
+    sb->block_size = BLOCK_SIZE;
+    sb->root_inum = inode_idx;
+    sb->geo = geo;
+    mark_dirty(sb, sizeof(Superblock));
+
+    return 0;
+}
+
+// 메모리 파티션
+int ku_fs_init(unsigned int partition_size, unsigned int inode_count) {
+    if (ku_fs_layout(partition_size, inode_count)) {
+        return -1;
+    }
+    partition = calloc(1, geo.partition_size);
+    if (!partition) {
+        return -1;
+    }
+    return ku_fs_format();
+}
 
-    int data_block_offset = data_block_idx * BLOCK_SIZE + 8*BLOCK_SIZE;
-    root_data_block = (partition + data_block_offset); // 루트 디렉토리 데이터 블럭 실제 위치
+// 이미지 파일을 새로 만들어 mmap (ftruncate로 늘린 부분은 0이라 메타데이터만 기록)
+int ku_fs_mkfs(char* path, unsigned int partition_size, unsigned int inode_count) {
+    if (ku_fs_layout(partition_size, inode_count)) {
+        return -1;
+    }
+    image_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (image_fd == -1) {
+        return -1;
+    }
+    if (ftruncate(image_fd, geo.partition_size) == -1) {
+        return -1;
+    }
+    partition = mmap(NULL, geo.partition_size, PROT_READ | PROT_WRITE, MAP_SHARED, image_fd, 0);
+    if (partition == MAP_FAILED) {
+        return -1;
+    }
+    return ku_fs_format();
+}
 
+// 이미지 파일을 mmap하고 슈퍼블럭 검사, 디렉토리 인덱스는 처음 쓸 때 구성
+int ku_fs_mount(char* path) {
+    struct stat st;
+    Superblock sb;
+
+    image_fd = open(path, O_RDWR);
+    if (image_fd == -1 || fstat(image_fd, &st) == -1 || st.st_size < BLOCK_SIZE) {
+        return -1;
+    }
+    if (pread(image_fd, &sb, sizeof(sb), 0) != sizeof(sb)) {
+        return -1;
+    }
+    if (sb.magic != KU_FS_MAGIC || sb.block_size != BLOCK_SIZE ||
+            sb.geo.partition_size != st.st_size ||
+            ku_fs_layout(sb.geo.partition_size, sb.geo.inode_count) ||
+            memcmp(&sb.geo, &geo, sizeof(Geometry)) != 0 ||
+            sb.root_inum >= geo.inode_count) {
+        return -1;
+    }
+    partition = mmap(NULL, geo.partition_size, PROT_READ | PROT_WRITE, MAP_SHARED, image_fd, 0);
+    if (partition == MAP_FAILED) {
+        return -1;
+    }
+    ku_fs_attach();
+    if (!dirty_blocks) {
+        return -1;
+    }
+    root_inode = get_inode(sb.root_inum);
+    if (!is_mapped_inum(inode_bitmap, sb.root_inum) || root_inode->blocks == 0) {
+        return -1;
+    }
+    // 할당된 inode를 모두 검사해야 읽기, 쓰기가 매핑 밖으로 나가지 않음
+    for (int inum = bitmap_scan(&inode_alloc, 0, inode_alloc.nbits, 1); inum != -1;
+            inum = bitmap_scan(&inode_alloc, inum + 1, inode_alloc.nbits, 1)) {
+        if (inode_check(get_inode(inum))) {
+            return -1;
+        }
+    }
+    root_data_block = get_data_block(root_inode->extent[0].start);
+    return 0;
+}
+
+// 이미지에서 읽은 inode의 익스텐트와 오버플로 블럭이 data 영역 안에 있는지 검사
+int inode_check(Inode* inode) {
+    if (inode->extents > INODE_EXTENTS + OVERFLOW_EXTENTS || inode->overflow >= geo.data_count) {
+        return -1;
+    }
+    if (inode->extents > INODE_EXTENTS && inode->overflow == 0) {
+        return -1;
+    }
+    unsigned int blocks = 0;
+    for (unsigned int i = 0; i < inode->extents; i++) {
+        Extent* ext = inode_extent(inode, i);
+        if (ext->len == 0 || ext->start >= geo.data_count || ext->len > geo.data_count - ext->start ||
+                ext->len > geo.data_count - blocks) {
+            return -1;
+        }
+        blocks += ext->len;
+    }
+    if (blocks != inode->blocks || inode->fsize > (unsigned long long)blocks * BLOCK_SIZE) {
+        return -1;
+    }
+    return 0;
+}
+
+// addr부터 len 바이트가 걸친 블럭을 변경 기록에 표시
+void mark_dirty(void* addr, unsigned int len) {
+    unsigned int first = ((char*)addr - (char*)partition) / BLOCK_SIZE;
+    unsigned int last = ((char*)addr - (char*)partition + len - 1) / BLOCK_SIZE;
+    for (unsigned int b = first; b <= last; b++) {
+        dirty_blocks[b] = 1;
+    }
+    if (first < dirty_lo) {
+        dirty_lo = first;
+    }
+    if (last + 1 > dirty_hi) {
+        dirty_hi = last + 1;
+    }
+}
+
+// 바뀐 블럭 구간만 msync, 연속된 블럭은 한 번에
+int ku_fs_sync() {
+    long page = sysconf(_SC_PAGESIZE);
+    for (unsigned int b = dirty_lo; b < dirty_hi; ) {
+        if (!dirty_blocks[b]) {
+            b++;
+            continue;
+        }
+        unsigned int e = b;
+        while (e < dirty_hi && dirty_blocks[e]) {
+            dirty_blocks[e++] = 0;
+        }
+        if (image_fd != -1) {
+            char* start = (char*)partition + (unsigned long)b * BLOCK_SIZE;
+            char* aligned = start - (start - (char*)partition) % page;
+            if (msync(aligned, (char*)partition + (unsigned long)e * BLOCK_SIZE - aligned, MS_SYNC) == -1) {
+                return -1;
+            }
+        }
+        b = e;
+    }
+    dirty_lo = geo.partition_size / BLOCK_SIZE;
+    dirty_hi = 0;
+    return 0;
+}
+
+// 파티션 전체를 그대로 파일로
+int ku_fs_export(char* path) {
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        return -1;
+    }
+    size_t n = fwrite(partition, 1, geo.partition_size, out);
+    if (fclose(out) || n != geo.partition_size) {
+        return -1;
+    }
+    return 0;
+}
+
+// 바뀐 블럭만 (블럭 번호 4바이트 + 블럭 내용) 레코드로
+int ku_fs_export_diff(char* path) {
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        return -1;
+    }
+    int error = 0;
+    for (unsigned int b = dirty_lo; b < dirty_hi && !error; b++) {
+        if (dirty_blocks[b]) {
+            error = fwrite(&b, sizeof(b), 1, out) != 1 ||
+                    fwrite((char*)partition + (unsigned long)b * BLOCK_SIZE, BLOCK_SIZE, 1, out) != 1;
+        }
+    }
+    if (fclose(out) || error) {
+        return -1;
+    }
+    return 0;
+}
+
+// 예전 출력 형식 ("%.2x " 연속), 블럭 단위로 만들어 한 번에 출력
+void ku_fs_dump_hex() {
+    static const char digits[] = "0123456789abcdef";
+    static char line[BLOCK_SIZE * 3];
+    for (unsigned int off = 0; off < geo.partition_size; off += BLOCK_SIZE) {
+        unsigned char* block = (unsigned char*)partition + off;
+        for (int i = 0; i < BLOCK_SIZE; i++) {
+            line[i * 3] = digits[block[i] >> 4];
+            line[i * 3 + 1] = digits[block[i] & 15];
+            line[i * 3 + 2] = ' ';
+        }
+        fwrite(line, 1, sizeof(line), stdout);
+    }
+}
+
+Inode* get_inode(unsigned int inum) {
+    return (Inode*)(partition + geo.inode_table_start * BLOCK_SIZE + inum * sizeof(Inode));
+}
+
+char* get_data_block(unsigned int blk) {
+    return partition + (geo.data_start + blk) * BLOCK_SIZE;
+}
+
+// i번째 익스텐트, INODE_EXTENTS개를 넘으면 오버플로 블럭에서
+Extent* inode_extent(Inode* inode, unsigned int i) {
+    if (i < INODE_EXTENTS) {
+        return &inode->extent[i];
+    }
+    return (Extent*)get_data_block(inode->overflow) + (i - INODE_EXTENTS);
+}
+
+// 파일 끝에 블럭 구간 추가, 마지막 익스텐트와 이어지면 늘리기만 함
+int inode_append(Inode* inode, unsigned int start, unsigned int len) {
+    if (inode->extents > 0) {
+        Extent* last = inode_extent(inode, inode->extents - 1);
+        if (last->start + last->len == start) {
+            last->len += len;
+            inode->blocks += len;
+            mark_dirty(inode, sizeof(Inode));
+            mark_dirty(last, sizeof(Extent));
+            return 0;
+        }
+    }
+    if (inode->extents == INODE_EXTENTS + OVERFLOW_EXTENTS) {
+        return -1;
+    }
+    if (inode->extents == INODE_EXTENTS && inode->overflow == 0) {
+        int overflow = bitmap_alloc(&data_alloc);
+        if (overflow == -1) {
+            return -1;
+        }
+        inode->overflow = overflow;
+    }
+    Extent* ext = inode_extent(inode, inode->extents++);
+    ext->start = start;
+    ext->len = len;
+    inode->blocks += len;
+    mark_dirty(inode, sizeof(Inode));
+    mark_dirty(ext, sizeof(Extent));
     return 0;
 }
 
@@ -123,6 +588,7 @@ void set_bitmap(char* bitmap, int inode_num) {
     unsigned char flag = 1;
     flag = flag << offset;
     bitmap[order] = bitmap[order] | flag;
+    mark_dirty(&bitmap[order], 1);
 }
 
 void clear_bitmap(char* bitmap, int inode_num) {
@@ -132,6 +598,7 @@ void clear_bitmap(char* bitmap, int inode_num) {
     flag = flag << offset;
     flag = ~flag;
     bitmap[order] = bitmap[order] & flag;
+    mark_dirty(&bitmap[order], 1);
 }
 
 int is_mapped_inum(char* bitmap, int inode_num) {
@@ -147,91 +614,316 @@ int is_mapped_inum(char* bitmap, int inode_num) {
     }
 }
 
-int find_free_bitmap_idx(char* bitmap) {
-    for (int i = 0; i < BLOCK_SIZE; i++) {
-        if (is_mapped_inum(bitmap, i) == 0) {
-            return i;
+// 비트맵 8바이트를 비트 순서(MSB 먼저) 그대로 정수로 읽기
+unsigned long long bitmap_word(char* map, int w) {
+    unsigned long long x;
+    memcpy(&x, map + w * 8, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    x = __builtin_bswap64(x);
+#endif
+    return x;
+}
+
+// [start, end) 구간에서 값이 val인 첫 번째 비트, 없으면 -1
+int bitmap_scan(Bitmap* bm, int start, int end, int val) {
+    for (int i = start; i < end; i = (i / 64 + 1) * 64) {
+        unsigned long long x = bitmap_word(bm->map, i / 64);
+        if (!val) {
+            x = ~x;
+        }
+        x &= ~0ULL >> (i % 64);
+        if (x) {
+            int idx = i / 64 * 64 + __builtin_clzll(x);
+            return (idx < end)? idx : -1;
         }
     }
     return -1;
 }
 
-int write_file(char* file_name, unsigned int byte) {
-    unsigned int new_inode_offset; // 새로 할당할 inode 위치
-    int error_flag = 0;
+// 빈 비트 하나를 next-fit으로 할당
+int bitmap_alloc(Bitmap* bm) {
+    int idx = bitmap_scan(bm, bm->hint, bm->nbits, 0);
+    if (idx == -1) {
+        idx = bitmap_scan(bm, 0, bm->hint, 0);
+    }
+    if (idx == -1) {
+        return -1;
+    }
+    set_bitmap(bm->map, idx);
+    bm->hint = (idx + 1 < bm->nbits)? idx + 1 : 0;
+    return idx;
+}
 
-    // 동일한 이름 파일 여부
-    for (int i = 0; i < BLOCK_SIZE; i+= 4) {
-        if (*(root_data_block+i) != 0) {
-            if (strcmp((root_data_block+i + 1), file_name) == 0) {
-                error_flag = 1;
+// 연속된 빈 비트 n개를 한 번에 할당, 시작 번호 반환
+int bitmap_alloc_run(Bitmap* bm, int n) {
+    int start = -1;
+    for (int pass = 0; pass < 2 && start == -1; pass++) {
+        int pos = pass ? 0 : bm->hint;
+        while (pos < bm->nbits) {
+            int s = bitmap_scan(bm, pos, bm->nbits, 0);
+            if (s == -1) {
                 break;
             }
+            int e = bitmap_scan(bm, s, bm->nbits, 1);
+            if (e == -1) {
+                e = bm->nbits;
+            }
+            if (e - s >= n) {
+                start = s;
+                break;
+            }
+            pos = e;
         }
     }
-    
-    if (error_flag == 0) {
-        // 4바이트씩 순회하면서 비어있는 inum 찾기
-        for (int i = 0; i < BLOCK_SIZE; i+=4) {
-            if (*(root_data_block+i) == 0) {
-                int new_inode_num = find_free_bitmap_idx(inode_bitmap);
-                if (new_inode_num == -1 || new_inode_num > 55) {
-                    error_flag = 3;
-                    break;
-                }
-                new_inode_offset = new_inode_num * sizeof(Inode) + 3 * BLOCK_SIZE;
-                Inode* new_inode = (partition + new_inode_offset);
-                new_inode->fsize = byte;
-                int pointer_cnt = 0;
-                unsigned int remain_byte = byte;
-                while (remain_byte) {
-                    int new_data_block_idx = find_free_bitmap_idx(data_bitmap);
-                    if (new_data_block_idx == -1 || new_data_block_idx > 55) {
-                        error_flag = 2;
-                        break;
-                    }
-                    if (pointer_cnt == 12) {
-                        error_flag = 2;
-                        break;
-                    }
-                    set_bitmap(data_bitmap, new_data_block_idx); // 추가
-                    new_inode->pointer[pointer_cnt] = new_data_block_idx;
-                    pointer_cnt++;
-                    new_inode->blocks = pointer_cnt;
-                    remain_byte = (remain_byte <= BLOCK_SIZE)? 0 : (remain_byte - BLOCK_SIZE);
-
-                }
-
-                if (error_flag) {
-                    break;
-                }
-
-                remain_byte = byte;
-
-                // 파일 내용 쓰기
-                while (remain_byte) {
-                    for (int j = 0; j < new_inode->blocks; j++) {
-                        if (remain_byte == 0) {
-                            break;
-                        }
-                        int data_block_no = new_inode->pointer[j];
-                        int data_block_offset = data_block_no * BLOCK_SIZE + 8*BLOCK_SIZE;
-                        char* data_block = (partition + data_block_offset);
-                        int smaller_byte = (remain_byte <= BLOCK_SIZE)? remain_byte : BLOCK_SIZE;
-
-                        for (int ptr = 0; ptr < smaller_byte; ptr++) {
-                            *(data_block + ptr) = file_name[0];
-                        }
-                        remain_byte -= smaller_byte;
-                    }
-                }
-
-                set_bitmap(inode_bitmap, new_inode_num);
-                *(root_data_block+i) = new_inode_num;
-                strcpy((root_data_block+i+1), file_name);
-                break;
+    if (start == -1) {
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        set_bitmap(bm->map, start + i);
+    }
+    bm->hint = (start + n < bm->nbits)? start + n : 0;
+    return start;
+}
+
+// start부터 n개가 모두 비어 있으면 그 자리를 할당
+int bitmap_alloc_at(Bitmap* bm, int start, int n) {
+    if (start + n > bm->nbits || bitmap_scan(bm, start, start + n, 1) != -1) {
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        set_bitmap(bm->map, start + i);
+    }
+    bm->hint = (start + n < bm->nbits)? start + n : 0;
+    return start;
+}
+
+// 파일이 blocks개의 블럭을 갖도록 할당, 실패하면 원래 크기로 되돌림
+int inode_grow(Inode* inode, unsigned int blocks) {
+    unsigned int old_blocks = inode->blocks;
+    if (blocks <= old_blocks) {
+        return 0;
+    }
+    unsigned int need = blocks - old_blocks;
+    if (need > geo.data_count) {
+        return -1;
+    }
+
+    // 마지막 익스텐트 바로 뒤, 그 다음 아무 연속 구간, 마지막으로 한 블럭씩
+    int run_start = -1;
+    if (inode->extents > 0) {
+        Extent* last = inode_extent(inode, inode->extents - 1);
+        run_start = bitmap_alloc_at(&data_alloc, last->start + last->len, need);
+    }
+    if (run_start == -1) {
+        run_start = bitmap_alloc_run(&data_alloc, need);
+    }
+    if (run_start != -1 && inode_append(inode, run_start, need) == -1) {
+        for (unsigned int i = 0; i < need; i++) {
+            clear_bitmap(data_bitmap, run_start + i);
+        }
+    }
+    while (inode->blocks < blocks) {
+        int new_data_block_idx = bitmap_alloc(&data_alloc);
+        if (new_data_block_idx == -1) {
+            inode_shrink(inode, old_blocks);
+            return -1;
+        }
+        if (inode_append(inode, new_data_block_idx, 1) == -1) {
+            clear_bitmap(data_bitmap, new_data_block_idx);
+            inode_shrink(inode, old_blocks);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// 파일 끝 쪽 블럭을 반환해 blocks개만 남김, 0이면 전부
+void inode_shrink(Inode* inode, unsigned int blocks) {
+    while (inode->blocks > blocks) {
+        Extent* last = inode_extent(inode, inode->extents - 1);
+        unsigned int cut = inode->blocks - blocks;
+        if (cut > last->len) {
+            cut = last->len;
+        }
+        for (unsigned int j = last->len - cut; j < last->len; j++) {
+            clear_bitmap(data_bitmap, last->start + j);
+        }
+        last->len -= cut;
+        inode->blocks -= cut;
+        mark_dirty(last, sizeof(Extent)); // 오버플로 블럭에 있으면 inode와 다른 블럭
+        if (last->len == 0) {
+            inode->extents--;
+        }
+    }
+    if (inode->extents <= INODE_EXTENTS && inode->overflow) {
+        clear_bitmap(data_bitmap, inode->overflow);
+        inode->overflow = 0;
+    }
+    mark_dirty(inode, sizeof(Inode));
+}
+
+// 파일 pos부터 len 바이트를 익스텐트 단위 memcpy로 복사
+// to_file이면 buf -> 파일 (buf가 NULL이면 0으로 채움), 아니면 파일 -> buf
+void inode_copy(Inode* inode, unsigned int pos, char* buf, unsigned int len, int to_file) {
+    unsigned int base = 0;  // 현재 익스텐트의 파일 내 시작 위치
+    for (unsigned int i = 0; i < inode->extents && len; i++) {
+        Extent* ext = inode_extent(inode, i);
+        unsigned int ext_bytes = ext->len * BLOCK_SIZE;
+        if (pos >= base + ext_bytes) {
+            base += ext_bytes;
+            continue;
+        }
+        char* data = get_data_block(ext->start) + (pos - base);
+        unsigned int n = base + ext_bytes - pos;
+        if (n > len) {
+            n = len;
+        }
+        if (!to_file) {
+            memcpy(buf, data, n);
+        }
+        else {
+            if (buf) {
+                memcpy(data, buf, n);
             }
+            else {
+                memset(data, 0, n);
+            }
+            mark_dirty(data, n);
+        }
+        if (buf) {
+            buf += n;
         }
+        pos += n;
+        len -= n;
+        base += ext_bytes;
+    }
+}
+
+// 이름 -> inode 번호, 없으면 -1
+int ku_fs_lookup(char* file_name) {
+    int off = dir_lookup(file_name);
+    return (off == -1)? -1 : (int)dir_entry(off)->inum;
+}
+
+// offset부터 iov 순서대로 쓰기, 파일 끝을 넘으면 한 번에 늘림 (덮어쓰기, 이어쓰기 모두)
+long ku_fs_pwritev(unsigned int inum, const struct iovec* iov, int iovcnt, unsigned int offset) {
+    if (inum >= geo.inode_count || !is_mapped_inum(inode_bitmap, inum)) {
+        return -1;
+    }
+    Inode* inode = get_inode(inum);
+    unsigned long total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    if (total > 0xffffffffUL - offset) {
+        return -1;
+    }
+    if (total == 0) { // 파일 끝 너머를 가리켜도 늘리지 않음
+        return 0;
+    }
+
+    unsigned int end = offset + total;
+    if (end > inode->fsize) {
+        if (inode_grow(inode, end / BLOCK_SIZE + (end % BLOCK_SIZE != 0)) == -1) {
+            return -1;
+        }
+        // 파일 끝과 offset 사이는 0으로
+        if (offset > inode->fsize) {
+            inode_copy(inode, inode->fsize, NULL, offset - inode->fsize, 1);
+        }
+    }
+
+    unsigned int pos = offset;
+    for (int i = 0; i < iovcnt; i++) {
+        inode_copy(inode, pos, iov[i].iov_base, iov[i].iov_len, 1);
+        pos += iov[i].iov_len;
+    }
+    if (end > inode->fsize) {
+        inode->fsize = end;
+        mark_dirty(inode, sizeof(Inode));
+    }
+    return total;
+}
+
+// offset부터 파일 끝까지 iov 순서대로 읽기, 읽은 바이트 수 반환
+long ku_fs_preadv(unsigned int inum, const struct iovec* iov, int iovcnt, unsigned int offset) {
+    if (inum >= geo.inode_count || !is_mapped_inum(inode_bitmap, inum)) {
+        return -1;
+    }
+    Inode* inode = get_inode(inum);
+    if (offset >= inode->fsize) {
+        return 0;
+    }
+
+    unsigned int remain = inode->fsize - offset;
+    unsigned int pos = offset;
+    for (int i = 0; i < iovcnt && remain; i++) {
+        unsigned int n = (iov[i].iov_len < remain)? iov[i].iov_len : remain;
+        inode_copy(inode, pos, iov[i].iov_base, n, 0);
+        pos += n;
+        remain -= n;
+    }
+    return pos - offset;
+}
+
+long ku_fs_pwrite(unsigned int inum, const void* buf, unsigned int count, unsigned int offset) {
+    struct iovec iov = { (void*)buf, count };
+    return ku_fs_pwritev(inum, &iov, 1, offset);
+}
+
+long ku_fs_pread(unsigned int inum, void* buf, unsigned int count, unsigned int offset) {
+    struct iovec iov = { buf, count };
+    return ku_fs_preadv(inum, &iov, 1, offset);
+}
+
+int write_file(char* file_name, unsigned int byte) {
+    static char fill[IO_CHUNK];
+    Inode* new_inode;   // 새로 할당할 inode
+    int new_inode_num;
+    int error_flag = 0;
+
+    // 동일한 이름 파일 여부
+    if (strlen(file_name) > NAME_MAX_LEN) {
+        error_flag = 4;
+    }
+    else if (dir_lookup(file_name) != -1) {
+        error_flag = 1;
+    }
+    
+    while (error_flag == 0) {
+        new_inode_num = bitmap_alloc(&inode_alloc);
+        if (new_inode_num == -1) {
+            error_flag = 3;
+            break;
+        }
+        new_inode = get_inode(new_inode_num);
+        memset(new_inode, 0, sizeof(Inode));
+        mark_dirty(new_inode, sizeof(Inode));
+
+        // 파일 내용: 모든 iovec이 같은 채움 버퍼를 가리키게 해서 한 번에 쓰기 (블럭 할당도 한 번)
+        int iovcnt = byte / IO_CHUNK + (byte % IO_CHUNK != 0);
+        struct iovec* iov = malloc((iovcnt + 1) * sizeof(struct iovec));
+        if (!iov) {
+            error_flag = 2;
+            break;
+        }
+        memset(fill, file_name[0], (byte < IO_CHUNK)? byte : IO_CHUNK);
+        for (int i = 0; i < iovcnt; i++) {
+            iov[i].iov_base = fill;
+            iov[i].iov_len = (i < iovcnt - 1 || byte % IO_CHUNK == 0)? IO_CHUNK : byte % IO_CHUNK;
+        }
+        long written = ku_fs_pwritev(new_inode_num, iov, iovcnt, 0);
+        free(iov);
+        if (written == -1) {
+            error_flag = 2;
+            break;
+        }
+
+        // 디렉토리 엔트리 추가 (디렉토리 블럭이 모자라면 실패)
+        if (dir_insert(file_name, new_inode_num) == -1) {
+            error_flag = 2;
+        }
+        break;
     }
     
     // 에러 발생
@@ -241,23 +933,19 @@ int write_file(char* file_name, unsigned int byte) {
         }
         else if (error_flag == 2) {
             // 앞서 임시로 할당했던 데이터 초기화
-            Inode* del_inode = (partition + new_inode_offset);
-            for (int i = 0; i < del_inode->blocks; i++) {
-                clear_bitmap(data_bitmap, del_inode->pointer[i]);
-                del_inode->pointer[i] = 0;
-            }
-            clear_bitmap(inode_bitmap, new_inode_offset);
-
-            char* del_block = (char*)(del_inode);
-            for (int i = 0; i < 256; i++) {
-                *(del_block + i) = 0;
-            }
+            inode_shrink(new_inode, 0);
+            clear_bitmap(inode_bitmap, new_inode_num);
+            memset(new_inode, 0, sizeof(Inode));
+            mark_dirty(new_inode, sizeof(Inode));
                 
             printf("No space\n");
         }
         else if (error_flag == 3) {
             printf("No spaace\n");
         }
+        else if (error_flag == 4) {
+            printf("Name too long\n");
+        }
 
         return -1;
     }
@@ -266,79 +954,297 @@ int write_file(char* file_name, unsigned int byte) {
 }
 
 int read_file(char* file_name, unsigned int byte) {
-    // 동일한 이름 파일 여부
-    for (int i = 0; i < BLOCK_SIZE; i+=4) {
-        if (*(root_data_block+i) != 0) {
-            if (strcmp((root_data_block+i + 1), file_name) == 0) {
-                int target_file_inode_num = *(root_data_block+i);
-                int target_file_inode_offset = target_file_inode_num * sizeof(Inode) + 3*BLOCK_SIZE;
-                Inode* target_inode = (partition + target_file_inode_offset);
-
-                if (target_inode->fsize >= byte && byte > BLOCK_SIZE || 
-                        target_inode->fsize < byte && target_inode->fsize > BLOCK_SIZE) {
-                    
-                    unsigned int remain_byte = (target_inode->fsize > byte)? byte : target_inode->fsize;
-                    while (remain_byte) {
-                        for (int j = 0; j < target_inode->blocks; j++) {
-                            if (remain_byte == 0) {
-                                break;
-                            }
-                            int data_block_num = target_inode->pointer[j];
-                            int data_block_offset = data_block_num * BLOCK_SIZE + 8*BLOCK_SIZE;
-                            char* data_block = partition + data_block_offset;
-                            int size = (remain_byte > BLOCK_SIZE)? BLOCK_SIZE : remain_byte;
-
-                            for (int p = 0; p < size; p++) {
-                                printf("%c", *(data_block + p));
-                            }
-
-                            int smaller_byte = (remain_byte <= BLOCK_SIZE)? remain_byte : BLOCK_SIZE;
-                            remain_byte -= smaller_byte;
-                        }
-                           
-                    }
-                }
-                else {
-                    unsigned int remain_byte = (target_inode->fsize > byte)? byte : target_inode->fsize;
-                    int data_block_num = target_inode->pointer[0];
-                    int data_block_offset = data_block_num * BLOCK_SIZE + 8*BLOCK_SIZE;
-                    char* data_block = partition + data_block_offset;
-                    for (int j = 0; j < remain_byte; j++) {
-                        printf("%c", *(data_block + j));
-                    }
-                }
-
-                printf("\n");
-                return 0;
+    static char buf[IO_CHUNK];
+
+    // 해시 인덱스로 파일 탐색
+    int inum = ku_fs_lookup(file_name);
+    if (inum == -1) {
+        printf("No such file\n");
+        return -1; 
+    }
+
+    // 앞에서부터 byte 바이트 (파일보다 길면 파일 끝까지)
+    unsigned int pos = 0;
+    long n;
+    while (pos < byte && (n = ku_fs_pread(inum, buf, (byte - pos < IO_CHUNK)? byte - pos : IO_CHUNK, pos)) > 0) {
+        fwrite(buf, 1, n, stdout);
+        pos += n;
+    }
+
+    printf("\n");
+    return 0;
+}
+
+int delete_file(char* file_name) {
+    // 해시 인덱스로 파일 탐색
+    int off = dir_lookup(file_name);
+    if (off == -1) {
+        printf("No such file\n");
+        return -1;
+    }
+
+    int target_file_inode_num = dir_entry(off)->inum; //삭제해야 하는 inode 번호
+    Inode* target_inode = get_inode(target_file_inode_num);
+
+    inode_shrink(target_inode, 0);
+    clear_bitmap(inode_bitmap, target_file_inode_num);
+    dir_remove(off);
+
+    return 0;
+}
+
+// 디렉토리 오프셋(블럭 번호 * BLOCK_SIZE + 블럭 내 위치)의 엔트리
+Dirent* dir_entry(int off) {
+    return (Dirent*)(get_data_block(dir_blocks[off / BLOCK_SIZE]) + off % BLOCK_SIZE);
+}
+
+// FNV-1a
+unsigned int dir_hash(char* name, int len) {
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return h;
+}
+
+// 해시 인덱스를 new_cap 슬롯으로 재구성
+int dir_index_grow(unsigned int new_cap) {
+    DirSlot* new_index = malloc(new_cap * sizeof(DirSlot));
+    if (!new_index) {
+        return -1;
+    }
+    for (unsigned int i = 0; i < new_cap; i++) {
+        new_index[i].off = -1;
+    }
+    for (unsigned int i = 0; i < dir_index_cap; i++) {
+        if (dir_index[i].off == -1) {
+            continue;
+        }
+        unsigned int j = dir_index[i].hash & (new_cap - 1);
+        while (new_index[j].off != -1) {
+            j = (j + 1) & (new_cap - 1);
+        }
+        new_index[j] = dir_index[i];
+    }
+    free(dir_index);
+    dir_index = new_index;
+    dir_index_cap = new_cap;
+    return 0;
+}
+
+// 해시 인덱스에 오프셋 추가, 부하율 1/2를 넘으면 두 배로 확장
+int dir_index_add(unsigned int hash, int off) {
+    if ((dir_index_cnt + 1) * 2 > dir_index_cap && dir_index_grow(dir_index_cap * 2) == -1) {
+        return -1;
+    }
+
+    unsigned int i = hash & (dir_index_cap - 1);
+    while (dir_index[i].off != -1) {
+        i = (i + 1) & (dir_index_cap - 1);
+    }
+    dir_index[i].hash = hash;
+    dir_index[i].off = off;
+    dir_index_cnt++;
+    return 0;
+}
+
+// 이름에 해당하는 해시 슬롯 번호, 없으면 -1
+int dir_index_find(char* file_name, int len, unsigned int hash) {
+    unsigned int i = hash & (dir_index_cap - 1);
+    while (dir_index[i].off != -1) {
+        if (dir_index[i].hash == hash) {
+            Dirent* ent = dir_entry(dir_index[i].off);
+            if (ent->name_len == len && memcmp(ent->name, file_name, len) == 0) {
+                return i;
             }
         }
+        i = (i + 1) & (dir_index_cap - 1);
     }
+    return -1;
+}
 
-    printf("No such file\n");
-    return -1; 
+// 디렉토리 블럭 목록 끝에 data 블럭 추가
+int dir_blocks_push(unsigned int blk, int nblocks) {
+    if (nblocks == dir_blocks_cap) {
+        unsigned int new_cap = dir_blocks_cap ? dir_blocks_cap * 2 : 16;
+        unsigned int* new_blocks = realloc(dir_blocks, new_cap * sizeof(unsigned int));
+        if (!new_blocks) {
+            return -1;
+        }
+        dir_blocks = new_blocks;
+        unsigned short* new_slack = realloc(dir_slack, new_cap * sizeof(unsigned short));
+        if (!new_slack) {
+            return -1;
+        }
+        dir_slack = new_slack;
+        dir_blocks_cap = new_cap;
+    }
+    dir_blocks[nblocks] = blk;
+    dir_slack[nblocks] = BLOCK_SIZE;
+    return 0;
 }
 
-int delete_file(char* file_name) {
-    // 파일 순회
-    for (int i = 0; i < BLOCK_SIZE; i+=4) {
-        if (*(root_data_block+i) != 0) {
-            if (strcmp((root_data_block+i + 1), file_name) == 0) {
-                int target_file_inode_num = *(root_data_block+i); //삭제해야 하는 inode 번호
-                int target_file_inode_offset = target_file_inode_num * sizeof(Inode) + 3*BLOCK_SIZE;
-                Inode* target_inode = (partition + target_file_inode_offset);
-
-                for (int inum = 0; inum < target_inode->blocks; inum++) {
-                    int del_data_inode_num = target_inode->pointer[inum];
-                    clear_bitmap(data_bitmap, del_data_inode_num);
-                }
-                clear_bitmap(inode_bitmap, target_file_inode_num);
-                *(root_data_block+i) = 0;
-
-                return 0;
+// 마운트 시 디렉토리 블럭을 한 번 훑어 해시 인덱스 구성
+int dir_index_build() {
+    free(dir_index);
+    dir_index = NULL;
+    dir_index_cap = 0;
+    dir_index_cnt = 0;
+    if (dir_index_grow(64) == -1) {
+        return -1;
+    }
+
+    // 익스텐트를 펼쳐 논리 블럭 -> data 블럭 표 구성
+    int nblocks = 0;
+    for (unsigned int i = 0; i < root_inode->extents; i++) {
+        Extent* ext = inode_extent(root_inode, i);
+        for (unsigned int j = 0; j < ext->len; j++) {
+            if (dir_blocks_push(ext->start + j, nblocks++) == -1) {
+                return -1;
             }
         }
     }
 
-    printf("No such file\n");
+    // 이미지의 엔트리는 믿지 않음: rec_len이 0이거나 블럭을 넘으면 무한 반복이 되므로 거부
+    for (int b = 0; b < nblocks; b++) {
+        for (int o = 0; o < BLOCK_SIZE; o += dir_entry(b * BLOCK_SIZE + o)->rec_len) {
+            Dirent* ent = dir_entry(b * BLOCK_SIZE + o);
+            if (ent->rec_len < sizeof(Dirent) || ent->rec_len % 4 != 0 || o + ent->rec_len > BLOCK_SIZE) {
+                return -1;
+            }
+            if (ent->inum == 0) {
+                continue;
+            }
+            if (ent->inum >= geo.inode_count || DIRENT_SIZE(ent->name_len) > ent->rec_len ||
+                    dir_index_add(dir_hash(ent->name, ent->name_len), b * BLOCK_SIZE + o) == -1) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// 마운트 후 처음 디렉토리를 쓸 때 한 번만 인덱스 구성
+int dir_index_load() {
+    if (!dir_index_ready) {
+        if (dir_index_build() == -1) {
+            return -1;
+        }
+        dir_index_ready = 1;
+    }
+    return 0;
+}
+
+int dir_lookup(char* file_name) {
+    if (dir_index_load() == -1) {
+        return -1;
+    }
+    int len = strlen(file_name);
+    int slot = dir_index_find(file_name, len, dir_hash(file_name, len));
+    return (slot == -1)? -1 : dir_index[slot].off;
+}
+
+// 블럭 안에서 need 바이트를 넣을 수 있는 엔트리 탐색, 빈 엔트리는 합치면서 진행
+int dir_block_fit(int b, int need) {
+    int max_gap = 0;
+    for (int o = 0; o < BLOCK_SIZE; ) {
+        Dirent* ent = dir_entry(b * BLOCK_SIZE + o);
+        if (ent->inum == 0) {
+            while (o + ent->rec_len < BLOCK_SIZE && dir_entry(b * BLOCK_SIZE + o + ent->rec_len)->inum == 0) {
+                ent->rec_len += dir_entry(b * BLOCK_SIZE + o + ent->rec_len)->rec_len;
+                mark_dirty(ent, sizeof(Dirent));
+            }
+        }
+        int gap = ent->rec_len - ((ent->inum == 0)? 0 : DIRENT_SIZE(ent->name_len));
+        if (gap >= need) {
+            return o;
+        }
+        if (gap > max_gap) {
+            max_gap = gap;
+        }
+        o += ent->rec_len;
+    }
+    dir_slack[b] = max_gap;
     return -1;
 }
+
+int dir_insert(char* file_name, int inum) {
+    if (dir_index_load() == -1) {
+        return -1;
+    }
+    int len = strlen(file_name);
+    int need = DIRENT_SIZE(len);
+    int b, o = -1;
+
+    for (b = 0; b < root_inode->blocks; b++) {
+        if (dir_slack[b] >= need && (o = dir_block_fit(b, need)) != -1) {
+            break;
+        }
+    }
+
+    // 빈 공간이 없으면 디렉토리 블럭 추가
+    if (o == -1) {
+        int data_block_idx = bitmap_alloc(&data_alloc);
+        if (data_block_idx == -1) {
+            return -1;
+        }
+        if (dir_blocks_push(data_block_idx, b) == -1 || inode_append(root_inode, data_block_idx, 1) == -1) {
+            clear_bitmap(data_bitmap, data_block_idx);
+            return -1;
+        }
+        root_inode->fsize = root_inode->blocks * BLOCK_SIZE;
+        mark_dirty(root_inode, sizeof(Inode));
+        o = 0;
+        Dirent* first = dir_entry(b * BLOCK_SIZE);
+        first->inum = 0;
+        first->rec_len = BLOCK_SIZE;
+        mark_dirty(first, sizeof(Dirent));
+    }
+
+    // 사용 중인 엔트리면 뒤쪽 남는 공간을 떼어 새 엔트리로
+    Dirent* ent = dir_entry(b * BLOCK_SIZE + o);
+    if (ent->inum != 0) {
+        int used = DIRENT_SIZE(ent->name_len);
+        Dirent* next = (Dirent*)((char*)ent + used);
+        next->rec_len = ent->rec_len - used;
+        ent->rec_len = used;
+        mark_dirty(ent, sizeof(Dirent));
+        ent = next;
+        o += used;
+    }
+    ent->inum = inum;
+    ent->name_len = len;
+    memcpy(ent->name, file_name, len);
+    mark_dirty(ent, DIRENT_SIZE(len));
+
+    if (dir_index_add(dir_hash(file_name, len), b * BLOCK_SIZE + o) == -1) {
+        ent->inum = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// 엔트리를 비우고 해시 슬롯은 뒤쪽 클러스터를 당겨서 제거 (tombstone 없음)
+void dir_remove(int off) {
+    Dirent* ent = dir_entry(off);
+    unsigned int i = dir_index_find(ent->name, ent->name_len, dir_hash(ent->name, ent->name_len));
+    ent->inum = 0;
+    mark_dirty(ent, sizeof(Dirent));
+    dir_slack[off / BLOCK_SIZE] = BLOCK_SIZE;
+
+    unsigned int j = i;
+    while (1) {
+        j = (j + 1) & (dir_index_cap - 1);
+        if (dir_index[j].off == -1) {
+            break;
+        }
+        unsigned int home = dir_index[j].hash & (dir_index_cap - 1);
+        // home이 (i, j] 구간 밖이면 i 자리로 당겨도 탐색 가능
+        if (((j - home) & (dir_index_cap - 1)) >= ((j - i) & (dir_index_cap - 1))) {
+            dir_index[i] = dir_index[j];
+            i = j;
+        }
+    }
+    dir_index[i].off = -1;
+    dir_index_cnt--;
+}
@@ -0,0 +1,162 @@
+/*
+ * MMU benchmark runner
+ * replays one trace through ku_cpu for every pmem x swap size of the matrix and reports
+ * ns/access, faults, swap-ins and swap-outs. ku_cpu runs in --quiet mode, each cell keeps
+ * the fastest of --repeat runs. Use binary traces (ku_trace_conv) so parsing stays out of the timing.
+ * sizes are in bytes and take a K, M or G suffix, options after -- are passed on to ku_cpu.
+ *
+ * gcc -O2 -o ku_bench_mmu ku_bench_mmu.c
+ * ./ku_bench_mmu <ku_cpu> <trace> --pmem=SIZE[,SIZE...] --swap=SIZE[,SIZE...] [--repeat=N] [-- ku_cpu options]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define ku_bench_MAX_SIZES 16
+#define ku_bench_MAX_ARGS 32
+
+typedef struct ku_bench_result {
+	size_t accesses;
+	double ns;
+	unsigned long long faults;
+	unsigned long long swap_ins;
+	unsigned long long swap_outs;
+} ku_bench_result;
+
+/* "64,128K,1M" -> sizes, returns how many were parsed or -1 */
+int ku_bench_sizes(const char *arg, unsigned long long *sizes)
+{
+	int n = 0;
+	char *end;
+
+	while(*arg){
+		if(n == ku_bench_MAX_SIZES)
+			return -1;
+		sizes[n] = strtoull(arg, &end, 10);
+		if(end == arg)
+			return -1;
+		if(*end == 'K' || *end == 'k') sizes[n] <<= 10, end++;
+		else if(*end == 'M' || *end == 'm') sizes[n] <<= 20, end++;
+		else if(*end == 'G' || *end == 'g') sizes[n] <<= 30, end++;
+		n++;
+		if(*end == ',')
+			end++;
+		else if(*end)
+			return -1;
+		arg = end;
+	}
+	return n;
+}
+
+/* runs ku_cpu once and parses its statistics from stderr, returns -1 if the run failed */
+int ku_bench_run(char **args, ku_bench_result *result)
+{
+	char buf[4096], *line;
+	size_t len = 0;
+	ssize_t r;
+	int fds[2], status, found = 0;
+	pid_t child;
+
+	if(pipe(fds) != 0)
+		return -1;
+	child = fork();
+	if(child == -1){
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	if(child == 0){
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		dup2(fds[1], STDERR_FILENO);
+		close(fds[0]);
+		execv(args[0], args);
+		_exit(127);
+	}
+
+	close(fds[1]);
+	while((r = read(fds[0], buf + len, sizeof(buf) - 1 - len)) > 0)
+		len += r;
+	close(fds[0]);
+	buf[len] = '\0';
+	if(waitpid(child, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		return -1;
+
+	for(line = strtok(buf, "\n"); line; line = strtok(NULL, "\n")){
+		double sec;
+		if(sscanf(line, "ku_cpu: %*d cpus, %zu accesses in %lf s", &result->accesses, &sec) == 2){
+			result->ns = sec * 1e9;
+			found |= 1;
+		}
+		else if(sscanf(line, "ku_cpu: policy %*[^,], faults %llu, swap in %llu, swap out %llu",
+				&result->faults, &result->swap_ins, &result->swap_outs) == 3)
+			found |= 2;
+	}
+	return found == 3 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long pmem[ku_bench_MAX_SIZES], swap[ku_bench_MAX_SIZES];
+	int npmem = 0, nswap = 0, repeat = 1, nargs = 0, i;
+	char *args[ku_bench_MAX_ARGS], pmem_arg[24], swap_arg[24];
+	ku_bench_result result, best;
+
+	if(argc < 3){
+		printf("ku_bench_mmu: Wrong number of arguments\n");
+		return 1;
+	}
+	for(i = 3; i < argc && strcmp(argv[i], "--") != 0; i++){
+		if(strncmp(argv[i], "--pmem=", 7) == 0) npmem = ku_bench_sizes(argv[i] + 7, pmem);
+		else if(strncmp(argv[i], "--swap=", 7) == 0) nswap = ku_bench_sizes(argv[i] + 7, swap);
+		else if(strncmp(argv[i], "--repeat=", 9) == 0) repeat = atoi(argv[i] + 9);
+		else{
+			printf("ku_bench_mmu: Unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if(npmem <= 0 || nswap <= 0 || repeat < 1){
+		printf("ku_bench_mmu: Invalid size list or repeat count\n");
+		return 1;
+	}
+
+	args[nargs++] = argv[1];
+	args[nargs++] = argv[2];
+	args[nargs++] = pmem_arg;
+	args[nargs++] = swap_arg;
+	args[nargs++] = "--quiet";
+	for(i++; i < argc; i++){
+		if(nargs == ku_bench_MAX_ARGS - 1){
+			printf("ku_bench_mmu: Too many ku_cpu options\n");
+			return 1;
+		}
+		args[nargs++] = argv[i];
+	}
+	args[nargs] = NULL;
+
+	printf("%12s %12s %12s %10s %12s %12s %12s\n", "pmem", "swap", "accesses", "ns/access", "faults", "swap in", "swap out");
+	for(int p = 0; p < npmem; p++){
+		for(int s = 0; s < nswap; s++){
+			snprintf(pmem_arg, sizeof(pmem_arg), "%llu", pmem[p]);
+			snprintf(swap_arg, sizeof(swap_arg), "%llu", swap[s]);
+			for(int r = 0; r < repeat; r++){
+				if(ku_bench_run(args, &result) != 0){
+					best.accesses = 0;
+					break;
+				}
+				if(r == 0 || result.ns < best.ns)
+					best = result;
+			}
+			if(best.accesses == 0)
+				printf("%12llu %12llu %12s\n", pmem[p], swap[s], "failed");
+			else
+				printf("%12llu %12llu %12zu %10.1f %12llu %12llu %12llu\n", pmem[p], swap[s], best.accesses,
+					best.ns / best.accesses, best.faults, best.swap_ins, best.swap_outs);
+			fflush(stdout);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * Context switch benchmark
+ * registers N processes and measures ku_run_proc over a random pid sequence.
+ * The cost per switch should stay flat as N grows.
+ *
+ * gcc -O2 -o ku_bench_proc ku_bench_proc.c
+ * ./ku_bench_proc [switches]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "./ku_mmu.h"
+
+#define ku_bench_SEQ_LEN 4096
+
+double ku_bench_now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long switches = 10000000;
+	char seq[ku_bench_SEQ_LEN];
+	struct ku_pte *ku_cr3;
+	unsigned long sink = 0;
+
+	if(argc > 1)
+		switches = strtoul(argv[1], NULL, 10);
+
+	if(!ku_mmu_init(64 * ku_mmu_PAGE_SIZE, 128 * ku_mmu_PAGE_SIZE)){
+		printf("ku_bench_proc: Fail to initialize the mmu\n");
+		return 1;
+	}
+
+	printf("%10s %12s\n", "processes", "ns/switch");
+	for(unsigned int nproc = 1; nproc <= ku_mmu_MAX_PROC; nproc *= 2){
+		/* PCBs are registered directly, physical memory only fits a few dozen page directories */
+		for(unsigned int pid = ku_mmu_running_process.count; pid < nproc; pid++)
+			ku_mmu_tableInsert(&ku_mmu_running_process, (char)pid);
+
+		srand(nproc);
+		for(int i = 0; i < ku_bench_SEQ_LEN; i++)
+			seq[i] = (char)(rand() % nproc);
+
+		double begin = ku_bench_now_ns();
+		for(unsigned long i = 0; i < switches; i++){
+			if(ku_run_proc(seq[i % ku_bench_SEQ_LEN], &ku_cr3) != 0){
+				printf("ku_bench_proc: Context switch is failed\n");
+				return 1;
+			}
+			sink += (unsigned long)ku_cr3;
+		}
+		double end = ku_bench_now_ns();
+
+		printf("%10u %12.2f\n", nproc, (end - begin) / switches);
+	}
+
+	return sink == 1; /* keep the loop from being optimized out */
+}
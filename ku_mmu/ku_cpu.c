@@ -1,8 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
 #include "./ku_mmu.h"
+#include "./ku_trace.h"
 
+#if ku_mmu_GEOMETRY == 8
 int ku_traverse(void *, char, void *);
+#else
+#define ku_traverse ku_mmu_walk /* ku_trav.o only knows the 8-bit layout */
+#endif
 
 void ku_mmu_fin(FILE *fd, void *pmem)
 {
@@ -10,67 +18,857 @@ void ku_mmu_fin(FILE *fd, void *pmem)
 	if(pmem) free(pmem);
 }
 
-int main(int argc, char *argv[])
+/* --tlb=ENTRIES[,WAYS[,lru|fifo|rand]], ENTRIES 0 turns the TLB off */
+int ku_tlb_parse(const char *arg, ku_tlb *tlb)
 {
-	FILE *fd=NULL;
-	char fpid, pid=0, va, pa;
-	unsigned int pmem_size, swap_size;
-	void *ku_cr3, *pmem=NULL;
+	unsigned int entries = ku_tlb_DEFAULT_ENTRIES, ways = ku_tlb_DEFAULT_WAYS;
+	ku_tlb_policy policy = ku_tlb_LRU;
+	char *end;
 
-	if(argc != 4){
-		printf("ku_cpu: Wrong number of arguments\n");
-		return 1;
+	if(arg){
+		entries = strtoul(arg, &end, 10);
+		ways = entries < ku_tlb_DEFAULT_WAYS ? entries : ku_tlb_DEFAULT_WAYS;
+		if(*end == ','){
+			ways = strtoul(end + 1, &end, 10);
+			if(*end == ','){
+				end++;
+				if(strcmp(end, "lru") == 0) policy = ku_tlb_LRU;
+				else if(strcmp(end, "fifo") == 0) policy = ku_tlb_FIFO;
+				else if(strcmp(end, "rand") == 0) policy = ku_tlb_RANDOM;
+				else return -1;
+				end += strlen(end);
+			}
+		}
+		if(*end != '\0') return -1;
+	}
+
+	return ku_tlb_init(tlb, entries, ways, policy);
+}
+
+#define ku_cpu_OUT_SIZE (1 << 16)
+
+/* per-cpu output buffer, flushed with one fwrite so lines of different cpus never mix */
+typedef struct ku_cpu_out {
+	char *buf;
+	size_t len;
+	int quiet; /* summary only, no per-access lines */
+} ku_cpu_out;
+
+void ku_out_flush(ku_cpu_out *out)
+{
+	fwrite(out->buf, 1, out->len, stdout);
+	out->len = 0;
+}
+
+void ku_out_str(ku_cpu_out *out, const char *str)
+{
+	while(*str)
+		out->buf[out->len++] = *str++;
+}
+
+void ku_out_num(ku_cpu_out *out, long long num, int is_signed)
+{
+	char digits[24];
+	int n = 0;
+	unsigned long long mag = (unsigned long long)num;
+
+	if(is_signed && num < 0){
+		out->buf[out->len++] = '-';
+		mag = -mag;
 	}
-	
+	do{
+		digits[n++] = '0' + mag % 10;
+		mag /= 10;
+	}while(mag);
+	while(n)
+		out->buf[out->len++] = digits[--n];
+}
+
+void ku_out_exit(ku_cpu_out *out, char pid)
+{
+	if(out->quiet)
+		return;
+	if(out->len > ku_cpu_OUT_SIZE - 128)
+		ku_out_flush(out);
+	out->buf[out->len++] = '[';
+	ku_out_num(out, pid, 1);
+	ku_out_str(out, "] Exit\n");
+}
+
+/* "[pid] Fork child" */
+void ku_out_fork(ku_cpu_out *out, char pid, char child)
+{
+	if(out->quiet)
+		return;
+	if(out->len > ku_cpu_OUT_SIZE - 128)
+		ku_out_flush(out);
+	out->buf[out->len++] = '[';
+	ku_out_num(out, pid, 1);
+	ku_out_str(out, "] Fork ");
+	ku_out_num(out, child, 1);
+	out->buf[out->len++] = '\n';
+}
+
+/* "[pid] Share va to [pid2] va2" */
+void ku_out_share(ku_cpu_out *out, char pid, ku_mmu_va_t va, char pid2, ku_mmu_va_t va2)
+{
+	if(out->quiet)
+		return;
+	if(out->len > ku_cpu_OUT_SIZE - 128)
+		ku_out_flush(out);
+	out->buf[out->len++] = '[';
+	ku_out_num(out, pid, 1);
+	ku_out_str(out, "] Share ");
+	ku_out_num(out, (long long)va, (ku_mmu_va_t)-1 < 0);
+	ku_out_str(out, " to [");
+	ku_out_num(out, pid2, 1);
+	ku_out_str(out, "] ");
+	ku_out_num(out, (long long)va2, (ku_mmu_va_t)-1 < 0);
+	out->buf[out->len++] = '\n';
+}
+
+/* "[pid] VA: va -> PA: pa", "[pid] VA: va -> Page Fault" or "[pid] VA: va -> Suspended" */
+void ku_out_access(ku_cpu_out *out, char pid, ku_mmu_va_t va, ku_mmu_va_t pa, int fault)
+{
+	if(out->quiet)
+		return;
+	if(out->len > ku_cpu_OUT_SIZE - 128)
+		ku_out_flush(out);
+	out->buf[out->len++] = '[';
+	ku_out_num(out, pid, 1);
+	ku_out_str(out, "] VA: ");
+	ku_out_num(out, (long long)va, (ku_mmu_va_t)-1 < 0); /* VAs print like ku_mmu_VA_FMT */
+	if(fault == 2)
+		ku_out_str(out, " -> Suspended\n");
+	else if(fault)
+		ku_out_str(out, " -> Page Fault\n");
+	else{
+		ku_out_str(out, " -> PA: ");
+		ku_out_num(out, (long long)pa, (ku_mmu_va_t)-1 < 0);
+		out->buf[out->len++] = '\n';
+	}
+}
+
+/*
+ * trace input, the binary format is mapped, text lines are "pid va [r|w|x|f]", va of a fork is the child pid.
+ * "pid va s pid2 va2" maps the page of pid at va into pid2 at va2, read as a ku_trace_SHARE and a ku_trace_MAP record
+ */
+typedef struct ku_cpu_input {
+	FILE *fd;
+	ku_trace trace;
+	int binary;
+} ku_cpu_input;
+
+size_t ku_cpu_read(ku_cpu_input *in, char *pids, ku_mmu_va_t *vas, char *ops, size_t max)
+{
+	char line[128], op;
+	size_t n = 0;
+
+	if(in->binary)
+		return ku_trace_read(&in->trace, pids, vas, ops, max);
+	while(n + 1 < max && fgets(line, sizeof(line), in->fd)){ /* room for both records of a share */
+		op = 'r';
+		if(sscanf(line, ku_mmu_TRACE_SCN " %c", &pids[n], &vas[n], &op) < 2)
+			continue;
+		if(op == 's'){
+			if(sscanf(line, "%*d %*s %*c " ku_mmu_TRACE_SCN, &pids[n + 1], &vas[n + 1]) != 2)
+				continue;
+			ops[n++] = ku_trace_SHARE;
+			ops[n++] = ku_trace_MAP;
+			continue;
+		}
+		ops[n++] = op == 'w' ? ku_trace_WRITE : op == 'x' ? ku_trace_EXIT : op == 'f' ? ku_trace_FORK : ku_trace_READ;
+	}
+	return n;
+}
+
+#define ku_cpu_RETRY 2 /* faults per access before giving up, a write may swap in a shared page and then copy it */
+#define ku_cpu_SMP_RETRY 16 /* same with several cpus, other cpus may evict the page again */
+
+/* records of the trace in order */
+typedef struct ku_cpu_queue {
+	char *pids;
+	ku_mmu_va_t *vas;
+	char *ops; /* ku_trace_READ, ku_trace_WRITE, ku_trace_EXIT, ku_trace_FORK, ku_trace_SHARE or ku_trace_MAP */
+	size_t len;
+	size_t cap;
+} ku_cpu_queue;
+
+typedef struct ku_cpu_core {
+	ku_tlb *tlb;
+	char pid;
+	void *ku_cr3;
+	void *pmem;
+	ku_cpu_queue stream; /* trace stream of this cpu */
+	ku_cpu_queue deferred; /* records of suspended pids, run again once they are resumed */
+	char waiting[256]; /* pids with deferred records, their later records are deferred behind them */
+	unsigned int replay_epoch; /* ku_mmu_admission_epoch when the deferred records were last run */
+	int replaying;
+	int error;
+	char stale; /* pid exited, switch again on its next access */
+	unsigned int epoch; /* ku_mmu_admission_epoch at the last switch or batch */
+	char share_pid; /* ku_trace_SHARE record waiting for its ku_trace_MAP */
+	ku_mmu_va_t share_va;
+	ku_cpu_out out;
+	pthread_t thread;
+} ku_cpu_core;
+
+unsigned long long ku_cpu_deferred; /* accesses of suspended processes, run once they are resumed */
+
+const char *ku_cpu_stats_path; /* --stats=PATH, "-" is stderr */
+volatile sig_atomic_t ku_cpu_stats_requested;
+
+void ku_cpu_stats_signal(int sig)
+{
+	ku_cpu_stats_requested = 1;
+}
+
+/* writes the JSON statistics of the mmu to --stats, stderr without it */
+void ku_cpu_stats_dump()
+{
+	FILE *out = stderr;
 
-	fd = fopen(argv[1], "r");
-	if(!fd){
-		printf("ku_cpu: Fail to open the input file\n");
+	if(ku_cpu_stats_path && strcmp(ku_cpu_stats_path, "-") != 0){
+		out = fopen(ku_cpu_stats_path, "w");
+		if(!out){
+			fprintf(stderr, "ku_cpu: Fail to open the stats file\n");
+			return;
+		}
+	}
+	ku_mmu_stats_json(out);
+	if(out != stderr)
+		fclose(out);
+	else
+		fflush(out);
+}
+
+/* SIGUSR1 asks for a dump, the replay loops write it between accesses */
+void ku_cpu_stats_poll()
+{
+	if(ku_cpu_stats_requested && __atomic_exchange_n(&ku_cpu_stats_requested, 0, __ATOMIC_RELAXED))
+		ku_cpu_stats_dump();
+}
+
+/* performs the access on physical memory, a write stores the pid so swapped pages carry data */
+void ku_cpu_touch(ku_cpu_core *cpu, ku_mmu_va_t pa, int pfn, int write)
+{
+	if(write)
+		((char *)cpu->pmem)[(ku_mmu_uva_t)pa] = cpu->pid;
+	ku_mmu_reference(pfn, cpu->pid, write);
+}
+
+int ku_cpu_push(ku_cpu_queue *queue, char pid, ku_mmu_va_t va, char op)
+{
+	if(queue->len == queue->cap){
+		size_t cap = queue->cap ? queue->cap * 2 : 1024;
+		char *pids = realloc(queue->pids, cap * sizeof(char));
+		if(!pids) return -1;
+		queue->pids = pids;
+		ku_mmu_va_t *vas = realloc(queue->vas, cap * sizeof(ku_mmu_va_t));
+		if(!vas) return -1;
+		queue->vas = vas;
+		char *ops = realloc(queue->ops, cap * sizeof(char));
+		if(!ops) return -1;
+		queue->ops = ops;
+		queue->cap = cap;
+	}
+	queue->pids[queue->len] = pid;
+	queue->vas[queue->len] = va;
+	queue->ops[queue->len] = op;
+	queue->len++;
+	return 0;
+}
+
+void ku_cpu_queue_free(ku_cpu_queue *queue)
+{
+	free(queue->pids);
+	free(queue->vas);
+	free(queue->ops);
+	memset(queue, 0, sizeof(*queue));
+}
+
+/* queues a record of fpid behind the deferred ones, a read or write prints as suspended when it first is */
+int ku_cpu_defer(ku_cpu_core *cpu, char fpid, ku_mmu_va_t va, int op)
+{
+	if(cpu->deferred.len == 0) /* a resume after the switch that saw it suspended runs it again */
+		cpu->replay_epoch = cpu->epoch;
+	if(ku_cpu_push(&cpu->deferred, fpid, va, op) != 0){
+		ku_out_flush(&cpu->out);
+		printf("ku_cpu: Fail to defer the access\n");
 		return 1;
 	}
+	cpu->waiting[(unsigned char)fpid] = 1;
+	if(op == ku_trace_FORK) /* the child can not run before it is forked */
+		cpu->waiting[(unsigned char)va] = 1;
+	if((op == ku_trace_READ || op == ku_trace_WRITE) && !cpu->replaying){
+		ku_mmu_count(&ku_cpu_deferred);
+		ku_out_access(&cpu->out, fpid, va, 0, 2);
+	}
+	return 0;
+}
 
-	pmem_size = strtol(argv[2], NULL, 10);
-	swap_size = strtol(argv[3], NULL, 10);
-	pmem = ku_mmu_init(pmem_size, swap_size);
-	if(!pmem){
-		printf("ku_cpu: Fail to allocate the physical memory\n");
-		ku_mmu_fin(fd, pmem);
+/* defers a record whose pids have deferred records, 1 if it was, -1 on failure */
+int ku_cpu_hold(ku_cpu_core *cpu, char fpid, ku_mmu_va_t va, int op)
+{
+	if(cpu->deferred.len == 0 || op == ku_trace_SHARE) /* a share is held with its ku_trace_MAP */
+		return 0;
+	if(op == ku_trace_MAP){
+		if(!cpu->waiting[(unsigned char)fpid] && !cpu->waiting[(unsigned char)cpu->share_pid])
+			return 0;
+		if(ku_cpu_defer(cpu, cpu->share_pid, cpu->share_va, ku_trace_SHARE) != 0)
+			return -1;
+	}
+	else if(!cpu->waiting[(unsigned char)fpid])
+		return 0;
+	return ku_cpu_defer(cpu, fpid, va, op) != 0 ? -1 : 1;
+}
+
+int ku_cpu_replay(ku_cpu_core *cpu);
+
+/* runs one access of the trace, prints the failure and returns 1 if it can not be served */
+int ku_cpu_access(ku_cpu_core *cpu, char fpid, ku_mmu_va_t va, int op)
+{
+	ku_mmu_va_t pa;
+	int pfn, write = op == ku_trace_WRITE, held;
+
+	/* a suspension or resume may let deferred records run, they go before this one. not between the records of a share */
+	if(cpu->deferred.len && !cpu->replaying && op != ku_trace_MAP &&
+		cpu->replay_epoch != __atomic_load_n(&ku_mmu_admission_epoch, __ATOMIC_ACQUIRE) && ku_cpu_replay(cpu) != 0)
 		return 1;
+	if((held = ku_cpu_hold(cpu, fpid, va, op)) != 0)
+		return held < 0;
+
+	if(op == ku_trace_EXIT){
+		if(ku_mmu_exit(fpid) != 0){
+			ku_out_flush(&cpu->out);
+			printf("ku_cpu: Exit is failed\n");
+			return 1;
+		}
+		if(cpu->pid == fpid)
+			cpu->stale = 1;
+		ku_out_exit(&cpu->out, fpid);
+		return 0;
+	}
+	if(op == ku_trace_FORK){
+		if(ku_mmu_fork(fpid, (char)va) != 0){
+			ku_out_flush(&cpu->out);
+			printf("ku_cpu: Fork is failed\n");
+			return 1;
+		}
+		ku_out_fork(&cpu->out, fpid, (char)va);
+		return 0;
+	}
+	if(op == ku_trace_SHARE){
+		cpu->share_pid = fpid;
+		cpu->share_va = va;
+		return 0;
+	}
+	if(op == ku_trace_MAP){
+		if(ku_mmu_share(cpu->share_pid, cpu->share_va, fpid, va) != 0){
+			ku_out_flush(&cpu->out);
+			printf("ku_cpu: Share is failed\n");
+			return 1;
+		}
+		ku_out_share(&cpu->out, cpu->share_pid, cpu->share_va, fpid, va);
+		return 0;
+	}
+
+	/* a pid still suspended is deferred again without asking ku_run_proc, which counts refusals */
+	if(cpu->replaying && ku_mmu_is_suspended(fpid))
+		return ku_cpu_defer(cpu, fpid, va, op);
+
+	/* a suspension or resume may change whether the running pid can stay */
+	if(cpu->pid != fpid || cpu->stale || cpu->epoch != __atomic_load_n(&ku_mmu_admission_epoch, __ATOMIC_ACQUIRE)){
+		cpu->epoch = __atomic_load_n(&ku_mmu_admission_epoch, __ATOMIC_ACQUIRE);
+		int ret = ku_run_proc(fpid, (struct ku_pte **)&cpu->ku_cr3);
+		if(ret == 0){
+			cpu->pid = fpid; /* context switch */
+			cpu->stale = 0;
+		}
+		else if(ret == 1){ /* suspended, the access runs once it is resumed */
+			cpu->stale = 1;
+			return ku_cpu_defer(cpu, fpid, va, op);
+		}
+		else{
+			ku_out_flush(&cpu->out);
+			printf("ku_cpu: Context switch is failed\n");
+			return 1;
+		}
+	}
+
+	/* VA 0 never translates, same as ku_traverse */
+	/* pages shared with a forked process are read-only, writing to them faults */
+	/* with --cpus an eviction waits until the translation, the store and the reference are done */
+	ku_mmu_access_begin(cpu->tlb);
+	pfn = va ? ku_tlb_lookup(cpu->tlb, cpu->pid, ku_mmu_VPN(va)) : -1;
+	if(pfn >= 0 && (!write || ku_mmu_writable(pfn))){
+		pa = ku_mmu_PA(pfn, va);
+		ku_cpu_touch(cpu, pa, pfn, write);
+		ku_mmu_access_end(cpu->tlb);
+		ku_out_access(&cpu->out, cpu->pid, va, pa, 0);
+		return 0;
+	}
+
+	pa = ku_traverse(cpu->ku_cr3, va, cpu->pmem);
+	for(int retry = 0; pa == 0 || (write && !ku_mmu_writable(ku_mmu_PA_PFN(pa))); retry++){
+		ku_mmu_access_end(cpu->tlb); /* the fault may evict */
+		if(retry == (ku_mmu_smp ? ku_cpu_SMP_RETRY : ku_cpu_RETRY)){
+			ku_out_flush(&cpu->out);
+			printf("ku_cpu: Addr tanslation is failed\n");
+			return 1;
+		}
+		if(ku_page_fault_rw(cpu->pid, va, pa != 0) != 0){
+			ku_out_flush(&cpu->out);
+			printf("ku_cpu: Fault handler is failed\n");
+			return 1;
+		}
+		if(retry == 0)
+			ku_out_access(&cpu->out, cpu->pid, va, 0, 1);
+
+		/* Retry after page fault */
+		ku_mmu_access_begin(cpu->tlb);
+		pa = ku_traverse(cpu->ku_cr3, va, cpu->pmem);
+	}
+
+	ku_mmu_tlb_fill(cpu->tlb, cpu->pid, va, ku_mmu_PA_PFN(pa));
+	ku_cpu_touch(cpu, pa, ku_mmu_PA_PFN(pa), write);
+	ku_mmu_access_end(cpu->tlb);
+	ku_out_access(&cpu->out, cpu->pid, va, pa, 0);
+	return 0;
+}
+
+/* runs the deferred records again in trace order, those of pids still suspended are deferred again */
+int ku_cpu_replay(ku_cpu_core *cpu)
+{
+	ku_cpu_queue queue = cpu->deferred;
+	int error = 0;
+
+	memset(&cpu->deferred, 0, sizeof(cpu->deferred));
+	memset(cpu->waiting, 0, sizeof(cpu->waiting));
+	cpu->replay_epoch = __atomic_load_n(&ku_mmu_admission_epoch, __ATOMIC_ACQUIRE);
+	cpu->replaying = 1;
+	for(size_t i = 0; i < queue.len && !error; i++)
+		error = ku_cpu_access(cpu, queue.pids[i], queue.vas[i], queue.ops[i]);
+	cpu->replaying = 0;
+	ku_cpu_queue_free(&queue);
+	return error;
+}
+
+/* at the end of the trace nothing else runs, the pid of the first deferred record is resumed for it */
+int ku_cpu_drain(ku_cpu_core *cpu)
+{
+	while(cpu->deferred.len){
+		if(ku_mmu_is_suspended(cpu->deferred.pids[0]) && ku_mmu_resume(cpu->deferred.pids[0]) != 0){
+			ku_out_flush(&cpu->out);
+			printf("ku_cpu: Context switch is failed\n");
+			return 1;
+		}
+		if(ku_cpu_replay(cpu) != 0)
+			return 1;
 	}
+	return 0;
+}
 
-	while(fscanf(fd, "%hhd %hhd", &fpid, &va) != EOF){
+/* runs a stretch of reads and writes through ku_translate_batch, the output is the one of ku_cpu_access */
+int ku_cpu_batch(ku_cpu_core *cpu, const char *pids, const ku_mmu_va_t *vas, const char *ops, size_t n)
+{
+	static ku_mmu_va_t pas[ku_trace_BATCH];
+	static unsigned char faults[ku_trace_BATCH / 8];
+	size_t done;
+	int ret;
 
-		if(pid != fpid){
-			if(ku_run_proc(fpid, &ku_cr3) == 0)
-				pid = fpid; /* context switch */
-			else{
-				printf("ku_cpu: Context switch is failed\n");
-				ku_mmu_fin(fd, pmem);
+	while(n > 0){
+		/* while records are deferred every access checks whether they can run first, as ku_cpu_access does */
+		if(cpu->deferred.len){
+			if(ku_cpu_access(cpu, pids[0], vas[0], ops[0]) != 0)
 				return 1;
-			} 
+			pids++;
+			vas++;
+			ops++;
+			n--;
+			continue;
 		}
+		cpu->stale = 1; /* the batch switches pids itself, the next single access switches again */
+		/* ku_trace_READ is 0 and ku_trace_WRITE 1, the ops of the stretch are its write flags */
+		cpu->epoch = __atomic_load_n(&ku_mmu_admission_epoch, __ATOMIC_ACQUIRE);
+		ku_mmu_access_begin(cpu->tlb);
+		ret = ku_translate_batch(cpu->tlb, pids, vas, ops, n, pas, faults, &done);
+		for(size_t i = 0; i < done; i++)
+			if(pas[i] != 0 && ops[i] == ku_trace_WRITE)
+				((char *)cpu->pmem)[(ku_mmu_uva_t)pas[i]] = pids[i];
+		ku_mmu_access_end(cpu->tlb);
+		for(size_t i = 0; i < done; i++){
+			if(pas[i] == 0){ /* only a suspended pid gets no address, the last one of the batch */
+				if(ku_cpu_defer(cpu, pids[i], vas[i], ops[i]) != 0)
+					return 1;
+				continue;
+			}
+			if(cpu->out.quiet)
+				continue;
+			if(faults[i / 8] & (1 << (i % 8)))
+				ku_out_access(&cpu->out, pids[i], vas[i], 0, 1);
+			ku_out_access(&cpu->out, pids[i], vas[i], pas[i], 0);
+		}
+		if(ret != 0){
+			if(faults[done / 8] & (1 << (done % 8)))
+				ku_out_access(&cpu->out, pids[done], vas[done], 0, 1);
+			ku_out_flush(&cpu->out);
+			printf(ret == ku_mmu_BATCH_SWITCH ? "ku_cpu: Context switch is failed\n" : ret == ku_mmu_BATCH_FAULT ?
+				"ku_cpu: Fault handler is failed\n" : "ku_cpu: Addr tanslation is failed\n");
+			return 1;
+		}
+		pids += done;
+		vas += done;
+		ops += done;
+		n -= done;
+	}
+	return 0;
+}
+
+void *ku_cpu_run(void *arg)
+{
+	ku_cpu_core *cpu = arg;
 
-		pa = ku_traverse(ku_cr3, va, pmem);
-		if(pa == 0){
-			if(ku_page_fault(pid, va) != 0){
-				printf("ku_cpu: Fault handler is failed\n");
-				ku_mmu_fin(fd, pmem);
+	for(size_t i = 0; i < cpu->stream.len && !cpu->error; i++){
+		if(i % ku_trace_BATCH == 0)
+			ku_cpu_stats_poll();
+		cpu->error = ku_cpu_access(cpu, cpu->stream.pids[i], cpu->stream.vas[i], cpu->stream.ops[i]);
+	}
+	if(!cpu->error)
+		cpu->error = ku_cpu_drain(cpu);
+	ku_out_flush(&cpu->out);
+	return NULL;
+}
+
+/*
+ * multi-cpu mode: every pid is pinned to cpu pid % ncpus, each cpu replays its own stream on a host thread.
+ * a forked child stays on the cpu of its parent, so only one cpu ever maps a copy-on-write page.
+ * the target of a share moves to the cpu of the sharing pid the same way and runs the share there
+ */
+/* "PID:N[,PID:N...]" of --quota and --priority, values[pid] = N and listed[pid] = 1. -1 if malformed */
+int ku_cpu_pid_list(const char *arg, long *values, char *listed)
+{
+	char *end;
+
+	while(*arg){
+		long pid = strtol(arg, &end, 10);
+		if(end == arg || *end != ':' || pid < -128 || pid > 255)
+			return -1;
+		arg = end + 1;
+		values[(unsigned char)pid] = strtol(arg, &end, 10);
+		listed[(unsigned char)pid] = 1;
+		if(end == arg)
+			return -1;
+		if(*end == ',')
+			end++;
+		else if(*end)
+			return -1;
+		arg = end;
+	}
+	return 0;
+}
+
+/* --quota=PAGES for every pid or --quota=PID:PAGES[,...], --priority=PID:PRIO[,...] */
+int ku_cpu_resident_sets(const char *quota_arg, const char *priority_arg)
+{
+	long values[256];
+	char listed[256];
+
+	memset(listed, 0, sizeof(listed));
+	if(quota_arg && strchr(quota_arg, ':')){
+		if(ku_cpu_pid_list(quota_arg, values, listed) != 0)
+			return -1;
+	}
+	else if(quota_arg){
+		memset(listed, 1, sizeof(listed));
+		for(int pid = 0; pid < 256; pid++)
+			values[pid] = strtol(quota_arg, NULL, 10);
+	}
+	for(int pid = 0; pid < 256; pid++){
+		if(listed[pid] && values[pid] < 0)
+			return -1;
+		if(listed[pid])
+			ku_mmu_set_quota((char)pid, (unsigned int)values[pid]);
+	}
+
+	memset(listed, 0, sizeof(listed));
+	if(priority_arg && ku_cpu_pid_list(priority_arg, values, listed) != 0)
+		return -1;
+	for(int pid = 0; pid < 256; pid++)
+		if(listed[pid])
+			ku_mmu_set_priority((char)pid, (int)values[pid]);
+	return 0;
+}
+
+/* replay time of the trace, ku_bench_mmu parses this line */
+void ku_cpu_report(int ncpus, size_t accesses, struct timespec *begin, struct timespec *end)
+{
+	double ns = (end->tv_sec - begin->tv_sec) * 1e9 + (end->tv_nsec - begin->tv_nsec);
+
+	fprintf(stderr, "ku_cpu: %d cpus, %zu accesses in %.6f s (%.1f ns/access)\n", ncpus, accesses, ns / 1e9,
+		accesses ? ns / accesses : 0.0);
+}
+
+/* frees the queues, output buffers and TLB entries of the first ncpus cpus */
+void ku_cpu_smp_free(ku_cpu_core *cpus, ku_tlb *tlbs, int ncpus)
+{
+	for(int i = 0; i < ncpus; i++){
+		ku_cpu_queue_free(&cpus[i].stream);
+		ku_cpu_queue_free(&cpus[i].deferred);
+		free(cpus[i].out.buf);
+		free(tlbs[i].entries);
+		tlbs[i].entries = NULL;
+		tlbs[i].sets = 0;
+	}
+}
+
+int ku_cpu_run_smp(ku_cpu_input *in, void *pmem, int ncpus, int quiet)
+{
+	ku_cpu_core cpus[ku_mmu_MAX_CPUS];
+	ku_tlb tlbs[ku_mmu_MAX_CPUS];
+	char pids[ku_trace_BATCH], ops[ku_trace_BATCH];
+	ku_mmu_va_t vas[ku_trace_BATCH];
+	size_t n, accesses = 0;
+	unsigned long long hits = 0, misses = 0;
+	struct timespec begin, end;
+	int error = 0, started;
+	unsigned char cpu_of[256];
+	char share_pid = 0;
+	ku_mmu_va_t share_va = 0;
+
+	memset(cpus, 0, sizeof(cpus));
+	for(int pid = 0; pid < 256; pid++)
+		cpu_of[pid] = pid % ncpus;
+	for(int i = 0; i < ncpus; i++){
+		tlbs[i] = ku_mmu_tlb; /* same geometry as --tlb, private entries */
+		if(ku_tlb_init(&tlbs[i], ku_mmu_tlb.sets * ku_mmu_tlb.ways, ku_mmu_tlb.ways, ku_mmu_tlb.policy) != 0){
+			printf("ku_cpu: Invalid TLB configuration\n");
+			ku_cpu_smp_free(cpus, tlbs, i + 1);
+			return 1;
+		}
+		cpus[i].tlb = &tlbs[i];
+		cpus[i].pmem = pmem;
+		cpus[i].out.quiet = quiet;
+		cpus[i].out.buf = malloc(ku_cpu_OUT_SIZE);
+		if(!cpus[i].out.buf){
+			printf("ku_cpu: Fail to allocate the output buffer\n");
+			ku_cpu_smp_free(cpus, tlbs, i + 1);
+			return 1;
+		}
+	}
+
+	while((n = ku_cpu_read(in, pids, vas, ops, ku_trace_BATCH)) > 0){
+		for(size_t i = 0; i < n; i++){
+			if(ops[i] == ku_trace_FORK)
+				cpu_of[(unsigned char)vas[i]] = cpu_of[(unsigned char)pids[i]];
+			if(ops[i] == ku_trace_SHARE){ /* pushed with its ku_trace_MAP, which may be in the next batch */
+				share_pid = pids[i];
+				share_va = vas[i];
+				continue;
+			}
+			if(ops[i] == ku_trace_MAP){
+				cpu_of[(unsigned char)pids[i]] = cpu_of[(unsigned char)share_pid];
+				if(ku_cpu_push(&cpus[cpu_of[(unsigned char)pids[i]]].stream, share_pid, share_va, ku_trace_SHARE) != 0){
+					printf("ku_cpu: Fail to load the input file\n");
+					ku_cpu_smp_free(cpus, tlbs, ncpus);
+					return 1;
+				}
+			}
+			if(ku_cpu_push(&cpus[cpu_of[(unsigned char)pids[i]]].stream, pids[i], vas[i], ops[i]) != 0){
+				printf("ku_cpu: Fail to load the input file\n");
+				ku_cpu_smp_free(cpus, tlbs, ncpus);
 				return 1;
 			}
-			printf("[%d] VA: %hhd -> Page Fault\n", pid, va);
+		}
+		accesses += n;
+	}
+
+	ku_mmu_smp_init(tlbs, ncpus);
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for(started = 0; started < ncpus; started++)
+		if(pthread_create(&cpus[started].thread, NULL, ku_cpu_run, &cpus[started]) != 0){
+			printf("ku_cpu: Fail to start cpu %d\n", started);
+			error = 1;
+			break;
+		}
+	for(int i = 0; i < started; i++){ /* the cpus that did start run their streams to the end */
+		pthread_join(cpus[i].thread, NULL);
+		error |= cpus[i].error;
+		hits += tlbs[i].hits;
+		misses += tlbs[i].misses;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ku_cpu_smp_free(cpus, tlbs, ncpus);
 
-			/* Retry after page fault */
-			pa = ku_traverse(ku_cr3, va, pmem); 
-			if(pa == 0){
-				printf("ku_cpu: Addr tanslation is failed\n");
-				ku_mmu_fin(fd, pmem);
+	ku_cpu_report(ncpus, accesses, &begin, &end);
+	ku_mmu_tlb.hits = hits;
+	ku_mmu_tlb.misses = misses;
+	return error;
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *fd=NULL;
+	char pids[ku_trace_BATCH], ops[ku_trace_BATCH];
+	ku_mmu_va_t vas[ku_trace_BATCH];
+	size_t n, pmem_size, swap_size, accesses = 0;
+	struct timespec begin, end;
+	void *pmem=NULL;
+	const char *tlb_arg = NULL, *quota_arg = NULL, *priority_arg = NULL;
+	ku_mmu_policy_type policy = ku_mmu_FIFO;
+	int ncpus = 1, quiet = 0, batch = 0, error = 0;
+	ku_cpu_core cpu;
+	ku_cpu_input in;
+
+	if(argc < 4){
+		printf("ku_cpu: Wrong number of arguments\n");
+		return 1;
+	}
+
+	for(int i = 4; i < argc; i++){
+		if(strncmp(argv[i], "--tlb=", 6) == 0) tlb_arg = argv[i] + 6;
+		else if(strcmp(argv[i], "--policy=fifo") == 0) policy = ku_mmu_FIFO;
+		else if(strcmp(argv[i], "--policy=clock") == 0) policy = ku_mmu_CLOCK;
+		else if(strcmp(argv[i], "--policy=lru") == 0) policy = ku_mmu_LRU;
+		else if(strcmp(argv[i], "--policy=2q") == 0) policy = ku_mmu_2Q;
+		else if(strcmp(argv[i], "--quiet") == 0) quiet = 1;
+		else if(strcmp(argv[i], "--batch") == 0) batch = 1; /* ku_translate_batch, not faster on every trace yet */
+		else if(strcmp(argv[i], "--no-batch") == 0) batch = 0; /* one access at a time, the default */
+		else if(strncmp(argv[i], "--stats=", 8) == 0) ku_cpu_stats_path = argv[i] + 8;
+		else if(strncmp(argv[i], "--swap-file=", 12) == 0) ku_mmu_swap_path = argv[i] + 12;
+		else if(strncmp(argv[i], "--zswap=", 8) == 0) ku_mmu_zswap = strtoull(argv[i] + 8, NULL, 10);
+		else if(strncmp(argv[i], "--fault-around=", 15) == 0) ku_mmu_fault_around = strtoul(argv[i] + 15, NULL, 10);
+		else if(strncmp(argv[i], "--readahead=", 12) == 0) ku_mmu_readahead = strtoul(argv[i] + 12, NULL, 10);
+		else if(strncmp(argv[i], "--quota=", 8) == 0) quota_arg = argv[i] + 8;
+		else if(strncmp(argv[i], "--pff=", 6) == 0) ku_mmu_pff = strtoul(argv[i] + 6, NULL, 10);
+		else if(strcmp(argv[i], "--admission") == 0) ku_mmu_admission = 1;
+		else if(strncmp(argv[i], "--priority=", 11) == 0) priority_arg = argv[i] + 11;
+		else if(strncmp(argv[i], "--huge=", 7) == 0){
+			ku_mmu_huge = strtoul(argv[i] + 7, NULL, 10);
+			if(ku_mmu_huge > 2 || (ku_mmu_huge && ku_mmu_GEOMETRY == 8)){
+				printf("ku_cpu: Huge pages need --huge=1 or 2 and a layout wider than 8 bits\n");
+				return 1;
+			}
+		}
+		else if(strncmp(argv[i], "--cpus=", 7) == 0){
+			ncpus = atoi(argv[i] + 7);
+			if(ncpus < 1 || ncpus > ku_mmu_MAX_CPUS){
+				printf("ku_cpu: Invalid number of cpus\n");
 				return 1;
 			}
 		}
+		else{
+			printf("ku_cpu: Unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
 
-		printf("[%d] VA: %hhd -> PA: %hhd\n", pid, va, pa);
+	signal(SIGUSR1, ku_cpu_stats_signal);
+	if(ku_tlb_parse(tlb_arg, &ku_mmu_tlb) != 0){
+		printf("ku_cpu: Invalid TLB configuration\n");
+		return 1;
 	}
 
+	memset(&in, 0, sizeof(in));
+	in.binary = ku_trace_open(&in.trace, argv[1]) == 0;
+	if(!in.binary){
+		fd = fopen(argv[1], "r");
+		if(!fd){
+			printf("ku_cpu: Fail to open the input file\n");
+			return 1;
+		}
+		in.fd = fd;
+	}
+
+	pmem_size = strtoull(argv[2], NULL, 10);
+	swap_size = strtoull(argv[3], NULL, 10);
+	pmem = ku_mmu_init_policy(pmem_size, swap_size, policy);
+	if(!pmem){
+		printf("ku_cpu: Fail to allocate the physical memory\n");
+		ku_mmu_fin(fd, pmem);
+		return 1;
+	}
+
+	if(ku_cpu_resident_sets(quota_arg, priority_arg) != 0){
+		printf("ku_cpu: Invalid quota or priority list\n");
+		ku_mmu_fin(fd, pmem);
+		return 1;
+	}
+
+	if(ncpus > 1)
+		error = ku_cpu_run_smp(&in, pmem, ncpus, quiet);
+	else{
+		memset(&cpu, 0, sizeof(cpu));
+		cpu.tlb = &ku_mmu_tlb;
+		cpu.pmem = pmem;
+		cpu.out.quiet = quiet;
+		cpu.out.buf = malloc(ku_cpu_OUT_SIZE);
+		if(!cpu.out.buf){
+			printf("ku_cpu: Fail to allocate the output buffer\n");
+			error = 1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		while(!error && (n = ku_cpu_read(&in, pids, vas, ops, ku_trace_BATCH)) > 0){
+			for(size_t i = 0, j; i < n && !error; i = j){
+				for(j = i; batch && j < n && (ops[j] == ku_trace_READ || ops[j] == ku_trace_WRITE); j++)
+					;
+				if(j - i > 1)
+					error = ku_cpu_batch(&cpu, pids + i, vas + i, ops + i, j - i);
+				else{
+					j = i + 1;
+					error = ku_cpu_access(&cpu, pids[i], vas[i], ops[i]);
+				}
+			}
+			accesses += n;
+			ku_cpu_stats_poll();
+		}
+		if(!error)
+			error = ku_cpu_drain(&cpu);
+		ku_cpu_queue_free(&cpu.deferred);
+		if(cpu.out.buf)
+			ku_out_flush(&cpu.out);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		free(cpu.out.buf);
+		if(!error)
+			ku_cpu_report(1, accesses, &begin, &end);
+	}
+	if(in.binary)
+		ku_trace_close(&in.trace);
+	ku_mmu_swap_close();
+	if(ku_cpu_stats_path)
+		ku_cpu_stats_dump();
+	if(error){
+		ku_mmu_fin(fd, pmem);
+		return 1;
+	}
+
+	fprintf(stderr, "ku_cpu: policy %s, faults %llu, swap in %llu, swap out %llu\n", ku_mmu_replacement->name,
+		ku_mmu_stat_faults, ku_mmu_stat_swap_ins, ku_mmu_stat_swap_outs);
+	fprintf(stderr, "ku_cpu: swap writes %llu, clean drops %llu, reads %llu, batches %llu\n",
+		ku_mmu_stat_swap_writes, ku_mmu_stat_swap_clean, ku_mmu_stat_swap_reads, ku_mmu_stat_swap_batches);
+	if(ku_mmu_zswap)
+		fprintf(stderr, "ku_cpu: zswap stores %llu, rejects %llu, loads %llu, writebacks %llu, ratio %.2f\n",
+			ku_mmu_stat_zswap_stores, ku_mmu_stat_zswap_rejects, ku_mmu_stat_zswap_loads,
+			ku_mmu_stat_zswap_writebacks, ku_mmu_zswap_ratio());
+	fprintf(stderr, "ku_cpu: page tables swapped out %llu, in %llu, exits %llu\n",
+		ku_mmu_stat_table_outs, ku_mmu_stat_table_ins, ku_mmu_stat_exits);
+	if(ku_mmu_stat_forks || ku_mmu_stat_shares)
+		fprintf(stderr, "ku_cpu: forks %llu, cow copies %llu, reuses %llu, shares %llu, shared evictions %llu\n",
+			ku_mmu_stat_forks, ku_mmu_stat_cow_copies, ku_mmu_stat_cow_reuses, ku_mmu_stat_shares,
+			ku_mmu_stat_shared_evictions);
+	if(ku_mmu_fault_around > 1 || ku_mmu_readahead > 0)
+		fprintf(stderr, "ku_cpu: fault-around %llu, readahead %llu, faults saved %llu, never used %llu (%llu evicted)\n",
+			ku_mmu_stat_fault_around, ku_mmu_stat_readahead, ku_mmu_stat_prefetch_used,
+			ku_mmu_stat_fault_around + ku_mmu_stat_readahead - ku_mmu_stat_prefetch_used, ku_mmu_stat_prefetch_evicted);
+	if(ku_mmu_huge)
+		fprintf(stderr, "ku_cpu: huge faults %llu, collapses %llu, splits %llu\n",
+			ku_mmu_stat_huge_faults, ku_mmu_stat_huge_collapses, ku_mmu_stat_huge_splits);
+	if(quota_arg || ku_mmu_pff || ku_mmu_admission)
+		fprintf(stderr, "ku_cpu: local evictions %llu, suspensions %llu, resumes %llu, deferred accesses %llu\n",
+			ku_mmu_stat_local_evictions, ku_mmu_stat_suspensions, ku_mmu_stat_resumes, ku_cpu_deferred);
+	if(ku_mmu_tlb.sets)
+		fprintf(stderr, "ku_cpu: TLB hits %llu, misses %llu\n", ku_mmu_tlb.hits, ku_mmu_tlb.misses);
+
 	ku_mmu_fin(fd, pmem);
 	return 0;
 }
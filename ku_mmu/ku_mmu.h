@@ -1,327 +1,3675 @@
-#define ku_mmu_PAGE_SIZE 4 // size of PAGE is 4Byte
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <sched.h>
+#include <errno.h>
+
+/*
+ * Address space geometry, chosen at compile time with -Dku_mmu_GEOMETRY=<va bits>
+ * every constant below is a literal, so the walk and fault code is specialized per geometry.
+ *   8  : 8-bit VA, 4B pages, PD/PMD/PT of 2 bits each, char pte (layout of ku_traverse)
+ *   32 : 32-bit VA, 4KiB pages, 2 levels of 10 bits, 32-bit pte
+ *   39 : 39-bit VA, 4KiB pages, 3 levels of 9 bits, 64-bit pte
+ *   48 : 48-bit VA, 4KiB pages, 4 levels of 9 bits, 64-bit pte
+ * pte is PFN | huge(1) | present(1) with the PFN starting at bit ku_mmu_PAGE_SHIFT,
+ * or swap offset | present(1) when the page is swapped out. huge is only set on PMD entries
+ * mapping a huge page (see Huge pages), never in the 8-bit layout.
+ */
+#ifndef ku_mmu_GEOMETRY
+#define ku_mmu_GEOMETRY 8
+#endif
+
+#if ku_mmu_GEOMETRY == 8
+#define ku_mmu_PAGE_SHIFT 2
+#define ku_mmu_LEVELS 3
+#define ku_mmu_LEVEL_BITS 2
+typedef char ku_mmu_entry_t;
+typedef unsigned char ku_mmu_uentry_t;
+typedef char ku_mmu_va_t; // also used for physical addresses
+typedef unsigned char ku_mmu_uva_t;
+typedef unsigned char ku_mmu_vpn_t;
 #define ku_mmu_MAX_PMEM_SIZE 64 // number of physical memory page is up to 2^6
 #define ku_mmu_MAX_SMEM_SIZE 128 // number of swap space page is up to 2^7
+#define ku_mmu_VA_FMT "%hhd"
+#define ku_mmu_TRACE_SCN "%hhd %hhd"
+#elif ku_mmu_GEOMETRY == 32
+#define ku_mmu_PAGE_SHIFT 12
+#define ku_mmu_LEVELS 2
+#define ku_mmu_LEVEL_BITS 10
+typedef unsigned int ku_mmu_entry_t;
+typedef unsigned int ku_mmu_uentry_t;
+typedef unsigned long long ku_mmu_va_t;
+typedef unsigned long long ku_mmu_uva_t;
+typedef unsigned int ku_mmu_vpn_t;
+#define ku_mmu_MAX_PMEM_SIZE (1u << 20) // 20-bit PFN
+#define ku_mmu_MAX_SMEM_SIZE (1u << 30)
+#define ku_mmu_VA_FMT "%llu"
+#define ku_mmu_TRACE_SCN "%hhd %llu"
+#elif ku_mmu_GEOMETRY == 39 || ku_mmu_GEOMETRY == 48
+#define ku_mmu_PAGE_SHIFT 12
+#define ku_mmu_LEVELS ((ku_mmu_GEOMETRY - 12) / 9)
+#define ku_mmu_LEVEL_BITS 9
+typedef unsigned long long ku_mmu_entry_t;
+typedef unsigned long long ku_mmu_uentry_t;
+typedef unsigned long long ku_mmu_va_t;
+typedef unsigned long long ku_mmu_uva_t;
+typedef unsigned long long ku_mmu_vpn_t;
+#define ku_mmu_MAX_PMEM_SIZE (1u << 30) // frame numbers are kept in an int
+#define ku_mmu_MAX_SMEM_SIZE (1u << 30)
+#define ku_mmu_VA_FMT "%llu"
+#define ku_mmu_TRACE_SCN "%hhd %llu"
+#else
+#error "ku_mmu_GEOMETRY must be 8, 32, 39 or 48"
+#endif
+
+#define ku_mmu_PAGE_SIZE (1 << ku_mmu_PAGE_SHIFT) // size of PAGE is 4Byte by default
+#define ku_mmu_VPN(va) ((ku_mmu_vpn_t)((ku_mmu_uva_t)(va) >> ku_mmu_PAGE_SHIFT))
+#define ku_mmu_OFFSET(va) ((ku_mmu_uva_t)(va) & (ku_mmu_PAGE_SIZE - 1))
+#define ku_mmu_INDEX(va, level) \
+    (((ku_mmu_uva_t)(va) >> (ku_mmu_PAGE_SHIFT + (ku_mmu_LEVELS - 1 - (level)) * ku_mmu_LEVEL_BITS)) & ((1 << ku_mmu_LEVEL_BITS) - 1))
+#define ku_mmu_PA(pfn, va) ((ku_mmu_va_t)(((ku_mmu_uva_t)(pfn) << ku_mmu_PAGE_SHIFT) + ku_mmu_OFFSET(va)))
+#define ku_mmu_PA_PFN(pa) ((int)((ku_mmu_uva_t)(pa) >> ku_mmu_PAGE_SHIFT))
+#define ku_mmu_PTE(pfn) ((ku_mmu_entry_t)(((ku_mmu_uentry_t)(pfn) << ku_mmu_PAGE_SHIFT) | 1))
+#define ku_mmu_PTE_PFN(entry) ((int)((ku_mmu_uentry_t)(entry) >> ku_mmu_PAGE_SHIFT))
+#define ku_mmu_PTE_SWAP(sfn) ((ku_mmu_entry_t)((ku_mmu_uentry_t)(sfn) << 1))
+#define ku_mmu_PTE_SFN(entry) ((unsigned int)((ku_mmu_uentry_t)(entry) >> 1))
+#define ku_mmu_HUGE_BIT 2
+#define ku_mmu_PTE_HUGE(entry) (((entry) & 3) == 3)
+#define ku_mmu_HUGE_LEVEL (ku_mmu_LEVELS - 2) // level whose entries may map huge pages
+#define ku_mmu_HUGE_PAGES (1 << ku_mmu_LEVEL_BITS) // frames of a huge page
 
 
 typedef struct ku_pte {
-    char entry;
+    ku_mmu_entry_t entry;
 } ku_pte;
 
+// a page table page must hold exactly one table
+typedef char ku_mmu_table_fits_page[((1 << ku_mmu_LEVEL_BITS) * sizeof(ku_pte) <= ku_mmu_PAGE_SIZE)? 1 : -1];
+
+/*
+ * Multi-cpu mode
+ * off by default, the locks below are only taken once ku_mmu_smp_init turned it on
+ * lock order: process table -> PCB -> replacement policy -> frame/swap bitmap -> TLB
+ * an evicted frame is written out or reused once the accesses in flight on it are done, see ku_mmu_access_begin
+ */
+#define ku_mmu_MAX_CPUS 64
+
+int ku_mmu_smp;
+
+#define ku_mmu_LOCK(lock) do { if (ku_mmu_smp) pthread_mutex_lock(lock); } while (0)
+#define ku_mmu_UNLOCK(lock) do { if (ku_mmu_smp) pthread_mutex_unlock(lock); } while (0)
+#define ku_mmu_SPIN_LOCK(lock) do { if (ku_mmu_smp) pthread_spin_lock(lock); } while (0)
+#define ku_mmu_SPIN_UNLOCK(lock) do { if (ku_mmu_smp) pthread_spin_unlock(lock); } while (0)
+
+// counters are bumped from several cpus without a common lock
+void ku_mmu_count(unsigned long long* counter) {
+    if (ku_mmu_smp) {
+        __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+    }
+    else {
+        (*counter)++;
+    }
+}
+
+void ku_mmu_add(unsigned long long* counter, unsigned long long n) {
+    if (ku_mmu_smp) {
+        __atomic_add_fetch(counter, n, __ATOMIC_RELAXED);
+    }
+    else {
+        *counter += n;
+    }
+}
+
+#define ku_mmu_MAX_PROC 256 // pid is a char, every pid has its own slot
+
+// per process counters, cleared when the pid exits
+typedef struct ku_mmu_proc_stat {
+    unsigned long long accesses; // translated accesses, counted by ku_mmu_reference
+    unsigned long long minor_faults; // served with a zero page, page tables may be allocated on the way
+    unsigned long long major_faults; // served by ku_mmu_swap_in
+    unsigned long long cow_faults; // writes to frames shared with a forked process
+    unsigned long long evictions_caused; // pages swapped out to find frames for its faults
+    unsigned long long evictions_suffered; // pages of its own swapped out
+    unsigned long long rss; // resident pages, page tables not included
+} ku_mmu_proc_stat;
+
 typedef struct ku_mmu_PCB {
+    char used;
     char pid;
-    char pfn_begin;
-    char pfn_end;
     ku_pte* pdbr;
-    struct ku_mmu_PCB* next;
+    ku_mmu_vpn_t ra_last; // readahead: vpn of the last fault
+    long long ra_stride; // vpn distance between the last two faults
+    ku_mmu_vpn_t ra_next; // first vpn after the pages read ahead
+    unsigned int ra_window; // pages read ahead on the last fault, 0 while no stream is seen
+    unsigned int quota; // resident pages it may keep, 0 for no limit. kept when the pid exits
+    int priority; // admission control suspends lower priorities first. kept when the pid exits
+    unsigned int allowance; // resident pages the PFF controller gives it, 0 before its first fault
+    unsigned long long pff_last; // its accesses at the last fault
+    char suspended; // refused by ku_run_proc until the admission control resumes it
+    unsigned int admitted; // ku_mmu_clock at its creation, last suspension or last resume
+    unsigned int hand; // next frame its own evictions look at
+    pthread_mutex_t lock; // page tables of this process
+    ku_mmu_proc_stat stat;
 } ku_mmu_PCB;
 
-typedef struct ku_mmu_list {
-    ku_mmu_PCB* head;
-} ku_mmu_list;
+// PCBs are stored in one array indexed by (unsigned char)pid
+typedef struct ku_mmu_table {
+    ku_mmu_PCB* pcbs;
+    unsigned int count;
+    pthread_mutex_t lock; // process creation
+} ku_mmu_table;
+
+/*
+ * Frame bitmap
+ * one bit per frame (set = in use) packed in 64-bit words, plus a summary
+ * level with one bit per word (set = word is full). Searches start at the
+ * word of the last allocation (next fit) and skip full words 64 at a time.
+ */
+typedef struct ku_mmu_bitmap {
+    unsigned long long* words;
+    unsigned long long* summary;
+    unsigned int size; // number of frames
+    unsigned int nwords;
+    unsigned int nsummary;
+    unsigned int hint; // word to start the next search from
+    unsigned long long allocs; // counters, updated under lock
+    unsigned long long frees;
+    unsigned long long failures; // allocations that found the bitmap full
+    pthread_mutex_t lock;
+} ku_mmu_bitmap;
 
-typedef struct ku_mmu_queue_node {
+/*
+ * Per frame information, allocated once at ku_mmu_init so the fault path never allocates
+ * pte/pid/vpn is the first mapper of the frame, further mappers of a shared frame are chained from
+ * rmap (see Reverse map). prev/next link the frame into replacement lists.
+ * a frame with pte == NULL is free or holds a page table, neither is seen by the policies.
+ * refs counts the leaf ptes mapping the frame. forked processes share frames copy-on-write, a frame
+ * with refs > 1 is read-only unless it is shared memory (ku_mmu_share). cow tells the cpu which
+ * frames are read-only, it is clear on free frames.
+ * a page table below the PD has parent set. present also counts the faults walking through it,
+ * while it is 0 the table sits on the idle table list, linked through prev/next as well
+ */
+typedef struct ku_mmu_frame {
+    ku_pte* pte; // first leaf pte mapping this frame
+    unsigned int refs; // leaf ptes mapping this frame, 0 if it is free or a page table
+    int rmap; // further mappers in ku_mmu_rmap_nodes, -1 if none
+    ku_pte* parent; // page table: entry pointing to it
+    unsigned int present; // page table: number of present entries plus walks holding it
+    char pid;
+    ku_mmu_vpn_t vpn;
+    char accessed; // shadow accessed bit, the pte has no spare bit for it
+    char dirty; // shadow dirty bit, set by the cpu on writes
+    char prefetched; // mapped by fault-around or readahead and not referenced yet
+    char cow; // shadow read-only bit, a write faults with ku_page_fault_rw
+    char shm; // shared memory, every mapper writes to it and eviction keeps its slot
+    char pinned; // kept from eviction while a copy of it is made
+    char huge; // frame of a huge page, the first frame of the run holds the state of all of it
+    char list; // 2Q list the frame is on
+    unsigned int swap; // swap slot still holding a copy of the page, 0 if none
+    unsigned int stamp; // time of the last reference
+    int table; // first frame of a huge page: PT page kept for its demotion
+    int prev;
+    int next;
+} ku_mmu_frame;
+
+/*
+ * Reverse map
+ * mappers of a shared frame after the first one, chained by index from ku_mmu_frame.rmap.
+ * nodes come from a pool that grows when it runs out, all of it is under ku_mmu_policy_lock
+ */
+typedef struct ku_mmu_rmap_node {
     ku_pte* pte;
-    struct ku_mmu_queue_node* next;
-} ku_mmu_queue_node;
+    char pid;
+    ku_mmu_vpn_t vpn;
+    int next;
+} ku_mmu_rmap_node;
+
+// a swap slot, the pte or frame that took it from the allocator holds the first use.
+// faults on a slot whose page is resident again map that frame instead of reading another copy
+typedef struct ku_mmu_slot {
+    unsigned int refs; // ptes and frames using the slot
+    int frame; // resident frame holding the slot, -1 if none
+    char shm; // the page is shared memory
+} ku_mmu_slot;
 
-typedef struct ku_mmu_queue {
-    ku_mmu_queue_node* front;
-    ku_mmu_queue_node* rear;
-} ku_mmu_queue;
+// intrusive list of frames linked through ku_mmu_frame.prev/next
+typedef struct ku_mmu_frame_list {
+    int head;
+    int tail;
+    unsigned int size;
+} ku_mmu_frame_list;
 
-void ku_mmu_listInit(ku_mmu_list* plist) {
-    plist->head = (ku_mmu_PCB*) malloc(sizeof(ku_mmu_PCB));
-    plist->head->next = NULL;
+typedef enum ku_mmu_policy_type {
+    ku_mmu_FIFO,
+    ku_mmu_CLOCK,
+    ku_mmu_LRU,
+    ku_mmu_2Q
+} ku_mmu_policy_type;
+
+typedef struct ku_mmu_policy {
+    const char* name;
+    int (*init)(unsigned int nframes);
+    void (*insert)(int pfn); // ku_mmu_frames[pfn] became a resident page
+    int (*evict)(); // removes a resident page and returns its pfn, -1 if none
+    void (*remove)(int pfn); // forgets a resident page that is being freed
+} ku_mmu_policy;
+
+/*
+ * Swap device
+ * slot n of swap space is page n of a file. swapped out pages are copied into
+ * the active batch and the fault path goes on; a background thread writes full
+ * batches sorted by slot, coalescing adjacent slots into one pwritev.
+ * slot -> batch index lookups let swap in read pages that are not written yet.
+ * with ku_mmu_zswap set, pages are compressed into a RAM tier in front of the file instead. the least
+ * recently stored or loaded ones are written back to the file when the tier is over its budget, pages
+ * that do not shrink by a quarter go to the file directly.
+ */
+#define ku_mmu_SWAP_BATCH 64
+#define ku_mmu_LZ_HASH_BITS 12
+#define ku_mmu_LZ_MAX_MATCH (127 + 4)
+
+typedef struct ku_mmu_swap_batch {
+    unsigned int slots[ku_mmu_SWAP_BATCH];
+    char* data; // ku_mmu_SWAP_BATCH pages, page i belongs to slots[i]
+    unsigned int count;
+} ku_mmu_swap_batch;
+
+// compressed copy of a slot, linked into the LRU list of the tier by slot (slot 0 is never used, it ends the list)
+typedef struct ku_mmu_zswap_entry {
+    unsigned char* data; // NULL if the slot is not in the tier
+    unsigned int len;
+    unsigned int prev;
+    unsigned int next;
+} ku_mmu_zswap_entry;
+
+typedef struct ku_mmu_swap_dev {
+    int fd;
+    ku_mmu_zswap_entry* tier; // slot -> compressed copy, NULL without a tier
+    unsigned int tier_head; // most recently used
+    unsigned int tier_tail;
+    unsigned int tier_pages;
+    size_t tier_bytes;
+    ku_mmu_swap_batch batches[2];
+    ku_mmu_swap_batch* active; // filled by swap out
+    ku_mmu_swap_batch* writing; // handed to the writer, NULL when it is idle
+    int* pending; // slot -> index in the active batch, -1 if not queued
+    char* failed; // slot -> 1 if its last write to the file failed, reading it back fails then
+    unsigned int lost; // slots marked failed
+    int stop;
+    pthread_mutex_t lock; // always taken, the writer is a thread even with one cpu
+    pthread_cond_t work;
+    pthread_cond_t done;
+    pthread_t writer;
+} ku_mmu_swap_dev;
+
+int ku_mmu_tableInit(ku_mmu_table* ptable) {
+    ptable->pcbs = (ku_mmu_PCB*) calloc(ku_mmu_MAX_PROC, sizeof(ku_mmu_PCB));
+    ptable->count = 0;
+    if (ptable->pcbs == NULL) {
+        return -1;
+    }
+    pthread_mutex_init(&ptable->lock, NULL);
+    for (int i = 0; i < ku_mmu_MAX_PROC; i++) {
+        pthread_mutex_init(&ptable->pcbs[i].lock, NULL);
+    }
+    return 0;
 }
 
-ku_mmu_PCB* ku_mmu_listInsert(ku_mmu_list* plist, char pid) {
-    ku_mmu_PCB* newNode = (ku_mmu_PCB*) malloc(sizeof(ku_mmu_PCB));
+ku_mmu_PCB* ku_mmu_tableInsert(ku_mmu_table* ptable, char pid) {
+    ku_mmu_PCB* newNode = &ptable->pcbs[(unsigned char)pid];
+    newNode->used = 1;
     newNode->pid = pid;
-    newNode->next = plist->head->next;
-    plist->head->next = newNode;
+    ptable->count++;
 
     return newNode;
 }
 
-ku_mmu_PCB* ku_mmu_listSearch(ku_mmu_list* plist, char targetPid) {
-    ku_mmu_PCB* curNode = plist->head->next;
-    while(curNode != NULL) {
-        if (curNode->pid == targetPid) {
-            return curNode;
-        }
-        curNode = curNode->next;
+void ku_mmu_tableRemove(ku_mmu_table* ptable, ku_mmu_PCB* node) {
+    node->used = 0;
+    node->pdbr = NULL;
+    node->ra_last = 0;
+    node->ra_stride = 0;
+    node->ra_next = 0;
+    node->ra_window = 0;
+    node->allowance = 0;
+    node->pff_last = 0;
+    node->suspended = 0;
+    node->admitted = 0;
+    node->hand = 0;
+    memset(&node->stat, 0, sizeof(node->stat));
+    ptable->count--;
+}
+
+ku_mmu_PCB* ku_mmu_tableSearch(ku_mmu_table* ptable, char targetPid) {
+    ku_mmu_PCB* curNode = &ptable->pcbs[(unsigned char)targetPid];
+    if (curNode->used) {
+        return curNode;
     }
 
     return NULL;
 }
 
-void ku_mmu_queueInit(ku_mmu_queue* pq) {
-    pq->front = NULL;
-    pq->rear = NULL;
+void ku_mmu_bitmapSet(ku_mmu_bitmap* pbm, unsigned int idx) {
+    unsigned int w = idx >> 6;
+    pbm->words[w] |= 1ULL << (idx & 63);
+    if (pbm->words[w] == ~0ULL) {
+        pbm->summary[w >> 6] |= 1ULL << (w & 63);
+    }
 }
 
-int ku_mmu_queueIsEmpty(ku_mmu_queue* pq) {
-    if (pq->front == NULL) {
-        return 1;
-    }
-    else {
-        return 0;
+void ku_mmu_bitmapClear(ku_mmu_bitmap* pbm, unsigned int idx) {
+    unsigned int w = idx >> 6;
+    pbm->words[w] &= ~(1ULL << (idx & 63));
+    pbm->summary[w >> 6] &= ~(1ULL << (w & 63));
+    if (pbm->words[pbm->hint] == ~0ULL) { // nearly full memory finds this frame directly
+        pbm->hint = w;
     }
 }
-void ku_mmu_enQueue(ku_mmu_queue* pq, ku_pte* pte) {
-    ku_mmu_queue_node* newNode = (ku_mmu_queue_node*)malloc(sizeof(ku_mmu_queue_node));
-    newNode->next = NULL;
-    newNode->pte = pte;
-    
-    if (ku_mmu_queueIsEmpty(pq)) {
-        pq->front = newNode;
-        pq->rear = newNode;
+
+int ku_mmu_bitmapTest(ku_mmu_bitmap* pbm, unsigned int idx) {
+    return (pbm->words[idx >> 6] >> (idx & 63)) & 1;
+}
+
+int ku_mmu_bitmapInit(ku_mmu_bitmap* pbm, unsigned int size) {
+    pbm->size = size;
+    pbm->nwords = (size + 63) / 64;
+    if (pbm->nwords == 0) {
+        pbm->nwords = 1;
     }
-    else {
-        pq->rear->next = newNode;
-        pq->rear = newNode;
+    pbm->nsummary = (pbm->nwords + 63) / 64;
+    pbm->hint = 0;
+    pbm->allocs = 0;
+    pbm->frees = 0;
+    pbm->failures = 0;
+    pthread_mutex_init(&pbm->lock, NULL);
+    pbm->words = (unsigned long long*) calloc(pbm->nwords, sizeof(unsigned long long));
+    pbm->summary = (unsigned long long*) calloc(pbm->nsummary, sizeof(unsigned long long));
+    if (pbm->words == NULL || pbm->summary == NULL) {
+        return -1;
     }
-}
 
-ku_pte* ku_mmu_deQueue(ku_mmu_queue* pq) {
-    if (ku_mmu_queueIsEmpty(pq)) {
-        return NULL;
+    // bits past the last frame and words past the last word are never free
+    for (unsigned int i = size; i < pbm->nwords * 64; i++) {
+        ku_mmu_bitmapSet(pbm, i);
+    }
+    for (unsigned int w = pbm->nwords; w < pbm->nsummary * 64; w++) {
+        pbm->summary[w >> 6] |= 1ULL << (w & 63);
     }
-    ku_mmu_queue_node* delNode = pq->front;
-    ku_pte* delData = delNode->pte;
-    pq->front = pq->front->next;
 
-    free(delNode);
-    return delData;
+    return 0;
 }
 
+// returns index of a free frame without taking it, or -1. caller holds pbm->lock
+int ku_mmu_bitmapFind(ku_mmu_bitmap* pbm) {
+    unsigned int start = pbm->hint >> 6;
+    unsigned long long free_words = ~pbm->summary[start] & (~0ULL << (pbm->hint & 63));
 
-ku_mmu_PCB* ku_mmu_create_process(char pid);
-int ku_mmu_find_free_physical_page();
-int ku_mmu_swap_out();
-int ku_mmu_swap_in(unsigned char pte);
+    for (unsigned int i = 0; i <= pbm->nsummary; i++) {
+        if (free_words) {
+            unsigned int w = ((start + i) % pbm->nsummary) * 64 + __builtin_ctzll(free_words);
+            pbm->hint = w;
+            return w * 64 + __builtin_ctzll(~pbm->words[w]);
+        }
+        free_words = ~pbm->summary[(start + i + 1) % pbm->nsummary];
+    }
 
+    return -1;
+}
 
-ku_pte* ku_mmu_pmem_base_addr; // physical memory base address
-ku_pte* ku_mmu_swap_space_base_addr; // swap space base address
+// finds and takes a free frame, -1 if none
+int ku_mmu_bitmapAlloc(ku_mmu_bitmap* pbm) {
+    ku_mmu_LOCK(&pbm->lock);
+    int idx = ku_mmu_bitmapFind(pbm);
+    if (idx != -1) {
+        ku_mmu_bitmapSet(pbm, idx);
+        pbm->allocs++;
+    }
+    else {
+        pbm->failures++;
+    }
+    ku_mmu_UNLOCK(&pbm->lock);
+    return idx;
+}
 
-char* ku_mmu_pmem_free_list; // physical memory free list
-char* ku_mmu_swap_space_free_list; // swap space free list
+void ku_mmu_bitmapFree(ku_mmu_bitmap* pbm, unsigned int idx) {
+    ku_mmu_LOCK(&pbm->lock);
+    ku_mmu_bitmapClear(pbm, idx);
+    pbm->frees++;
+    ku_mmu_UNLOCK(&pbm->lock);
+}
 
-unsigned int ku_mmu_pmem_free_list_size;
-unsigned int ku_mmu_swap_space_free_list_size;
+// finds and takes n free frames starting at a multiple of n, n is a multiple of 64. first frame or -1
+// whole words are compared, a run is only looked for where no frame of it is taken
+int ku_mmu_bitmapAllocRun(ku_mmu_bitmap* pbm, unsigned int n) {
+    unsigned int span = n / 64;
+    int idx = -1;
+    if (span == 0 || n % 64 != 0) {
+        return -1;
+    }
 
-ku_mmu_list ku_mmu_running_process; // list of currently running processes
-ku_mmu_queue ku_mmu_demanded_page; // queue of pages that can be swap out
+    ku_mmu_LOCK(&pbm->lock);
+    for (unsigned int w = 0; w + span <= pbm->nwords && idx == -1; w += span) {
+        unsigned int i = 0;
+        while (i < span && pbm->words[w + i] == 0) {
+            i++;
+        }
+        if (i == span) {
+            idx = w * 64;
+        }
+    }
+    if (idx != -1) {
+        for (unsigned int i = 0; i < n; i++) {
+            ku_mmu_bitmapSet(pbm, idx + i);
+        }
+        pbm->allocs += n;
+    }
+    else {
+        pbm->failures++;
+    }
+    ku_mmu_UNLOCK(&pbm->lock);
+    return idx;
+}
 
+void ku_mmu_bitmapFreeRun(ku_mmu_bitmap* pbm, unsigned int idx, unsigned int n) {
+    ku_mmu_LOCK(&pbm->lock);
+    for (unsigned int i = 0; i < n; i++) {
+        ku_mmu_bitmapClear(pbm, idx + i);
+    }
+    pbm->frees += n;
+    ku_mmu_UNLOCK(&pbm->lock);
+}
 
-void* ku_mmu_init(unsigned int pmem_size, unsigned int swap_size) {
-    ku_mmu_pmem_base_addr = (ku_pte*) calloc(1, pmem_size);
-    ku_mmu_swap_space_base_addr = (ku_pte*) calloc(1, swap_size);
+/*
+ * Software TLB
+ * set associative, entries are tagged with pid as ASID so they survive context switches.
+ * caches only present leaf translations: vpn -> pfn. a huge page takes one entry, its vpn is the
+ * vpn of the huge page tagged with ku_tlb_HUGE and its pfn the first frame of the run
+ */
+#define ku_tlb_DEFAULT_ENTRIES 16
+#define ku_tlb_DEFAULT_WAYS 4
+#define ku_tlb_HUGE ((ku_mmu_vpn_t)1 << (sizeof(ku_mmu_vpn_t) * 8 - 1)) // above every vpn
 
-    if (ku_mmu_pmem_base_addr == NULL) {
-        return 0;
-    }
+typedef enum ku_tlb_policy {
+    ku_tlb_LRU,
+    ku_tlb_FIFO,
+    ku_tlb_RANDOM
+} ku_tlb_policy;
 
-    ku_mmu_pmem_free_list_size = pmem_size / ku_mmu_PAGE_SIZE;
-    ku_mmu_swap_space_free_list_size = swap_size / ku_mmu_PAGE_SIZE;
+typedef struct ku_tlb_entry {
+    char valid;
+    char asid;
+    ku_mmu_vpn_t vpn;
+    unsigned int pfn;
+    unsigned int stamp; // last use (LRU) or fill time (FIFO)
+} ku_tlb_entry;
 
-    if (ku_mmu_pmem_free_list_size > ku_mmu_MAX_PMEM_SIZE) {
-        ku_mmu_pmem_free_list_size = ku_mmu_MAX_PMEM_SIZE;
+typedef struct ku_tlb {
+    ku_tlb_entry* entries; // sets * ways, ways of one set are contiguous
+    unsigned int sets;
+    unsigned int ways;
+    ku_tlb_policy policy;
+    unsigned int clock;
+    unsigned int seed;
+    unsigned long long hits;
+    unsigned long long misses;
+    char huge; // set once a huge page is cached, lookups that miss then try its entry too
+    pthread_spinlock_t lock; // taken by the owning cpu and by shootdowns
+    unsigned int access; // odd while the owning cpu is between ku_mmu_access_begin and ku_mmu_access_end
+} ku_tlb;
+
+int ku_tlb_init(ku_tlb* tlb, unsigned int entries, unsigned int ways, ku_tlb_policy policy) {
+    tlb->entries = NULL;
+    tlb->sets = 0;
+    tlb->ways = 0;
+    tlb->policy = policy;
+    tlb->clock = 0;
+    tlb->seed = 1;
+    tlb->hits = 0;
+    tlb->misses = 0;
+    tlb->huge = 0;
+    tlb->access = 0;
+    pthread_spin_init(&tlb->lock, PTHREAD_PROCESS_PRIVATE);
+
+    if (entries == 0) { // TLB disabled
+        return 0;
     }
-    if (ku_mmu_swap_space_free_list_size > ku_mmu_MAX_SMEM_SIZE) {
-        ku_mmu_swap_space_free_list_size = ku_mmu_MAX_SMEM_SIZE;
+    if (ways == 0 || ways > entries || entries % ways != 0) {
+        return -1;
     }
 
-    ku_mmu_pmem_free_list = (char*) calloc(sizeof(char), ku_mmu_pmem_free_list_size);
-    ku_mmu_pmem_free_list[0] = 1; // Occupied by OS
-    ku_mmu_swap_space_free_list = (char*) calloc(sizeof(char), ku_mmu_swap_space_free_list_size);
-    ku_mmu_swap_space_free_list[0] = 1; // don't use
+    tlb->entries = (ku_tlb_entry*) calloc(entries, sizeof(ku_tlb_entry));
+    if (tlb->entries == NULL) {
+        return -1;
+    }
+    tlb->sets = entries / ways;
+    tlb->ways = ways;
 
-    ku_mmu_listInit(&ku_mmu_running_process);
-    ku_mmu_queueInit(&ku_mmu_demanded_page);
+    return 0;
+}
 
-    return ku_mmu_pmem_base_addr;
+ku_tlb_entry* ku_tlb_set(ku_tlb* tlb, char asid, ku_mmu_vpn_t vpn) {
+    unsigned int idx = (unsigned int)(vpn ^ (unsigned char)asid) % tlb->sets;
+    return tlb->entries + idx * tlb->ways;
 }
 
-int ku_run_proc(char pid, struct ku_pte** ku_cr3) {
+// pfn of the entry of (asid, vpn), -1 if none. caller holds tlb->lock
+int ku_tlb_probe(ku_tlb* tlb, char asid, ku_mmu_vpn_t vpn) {
+    ku_tlb_entry* set = ku_tlb_set(tlb, asid, vpn);
+    for (unsigned int i = 0; i < tlb->ways; i++) {
+        if (set[i].valid && set[i].asid == asid && set[i].vpn == vpn) {
+            if (tlb->policy == ku_tlb_LRU) {
+                set[i].stamp = ++tlb->clock;
+            }
+            return set[i].pfn;
+        }
+    }
+    return -1;
+}
 
-    ku_mmu_PCB* cur_node = ku_mmu_listSearch(&ku_mmu_running_process, pid);
-    if (cur_node == NULL) {
-        cur_node = ku_mmu_create_process(pid);
-        if (cur_node == NULL) {
-            return -1;
+// pfn of (asid, vpn) or of its huge page, -1 on miss. the caller counts the lookup. caller holds tlb->lock
+int ku_tlb_find(ku_tlb* tlb, char asid, ku_mmu_vpn_t vpn) {
+    int pfn = ku_tlb_probe(tlb, asid, vpn);
+    if (pfn == -1 && tlb->huge) {
+        pfn = ku_tlb_probe(tlb, asid, (vpn >> ku_mmu_LEVEL_BITS) | ku_tlb_HUGE);
+        if (pfn != -1) {
+            pfn += vpn & (ku_mmu_HUGE_PAGES - 1);
         }
     }
+    return pfn;
+}
 
-    *ku_cr3 = cur_node->pdbr;
+// returns pfn, or -1 on miss
+int ku_tlb_lookup(ku_tlb* tlb, char asid, ku_mmu_vpn_t vpn) {
+    if (tlb->sets == 0) {
+        return -1;
+    }
 
-    return 0;
+    ku_mmu_SPIN_LOCK(&tlb->lock);
+    int pfn = ku_tlb_find(tlb, asid, vpn);
+    if (pfn != -1) {
+        tlb->hits++;
+    }
+    else {
+        tlb->misses++;
+    }
+    ku_mmu_SPIN_UNLOCK(&tlb->lock);
+    return pfn;
 }
 
-int ku_page_fault(char pid, char va) {
+void ku_tlb_insert(ku_tlb* tlb, char asid, ku_mmu_vpn_t vpn, unsigned int pfn) {
+    if (tlb->sets == 0) {
+        return;
+    }
 
-    ku_mmu_PCB* cur_node = ku_mmu_listSearch(&ku_mmu_running_process, pid);
-    if (cur_node == NULL) {
-        return -1;
+    ku_tlb_entry* set = ku_tlb_set(tlb, asid, vpn);
+    ku_tlb_entry* victim = NULL;
+    ku_mmu_SPIN_LOCK(&tlb->lock);
+    for (unsigned int i = 0; i < tlb->ways; i++) {
+        if (!set[i].valid) {
+            victim = &set[i];
+            break;
+        }
     }
 
-    ku_pte* cur_pdbr = cur_node->pdbr;
-    unsigned char mask = 0b11000000; // PD_MASK
-    ku_pte* cur_pde = cur_pdbr + ((va & mask) >> 6);
-    if (cur_pde->entry == 0) {
-        int new_PFN_idx = ku_mmu_find_free_physical_page();
-        if (new_PFN_idx == -1) {
-            new_PFN_idx = ku_mmu_swap_out();
-            if (new_PFN_idx == -1) {
-                return -1;
+    if (victim == NULL) {
+        if (tlb->policy == ku_tlb_RANDOM) {
+            tlb->seed = tlb->seed * 1103515245 + 12345;
+            victim = &set[(tlb->seed >> 16) % tlb->ways];
+        }
+        else { // LRU and FIFO both evict the smallest stamp
+            victim = &set[0];
+            for (unsigned int i = 1; i < tlb->ways; i++) {
+                if (set[i].stamp < victim->stamp) {
+                    victim = &set[i];
+                }
             }
         }
+    }
 
-        ku_mmu_pmem_free_list[new_PFN_idx] = 1;
-        cur_pde->entry = (new_PFN_idx << 2) | 1;
+    victim->valid = 1;
+    victim->asid = asid;
+    victim->vpn = vpn;
+    victim->pfn = pfn;
+    victim->stamp = ++tlb->clock;
+    if (vpn & ku_tlb_HUGE) {
+        tlb->huge = 1;
     }
-    
-    mask = 0b00110000; // PMD_MASK
-    ku_pte* cur_pmde = (ku_pte*)(ku_mmu_pmem_base_addr + ((cur_pde->entry >> 2) * ku_mmu_PAGE_SIZE) + ((va & mask) >> 4));
-    if (cur_pmde->entry == 0) {
-        int new_PFN_idx = ku_mmu_find_free_physical_page();
-        if (new_PFN_idx == -1) {
-            new_PFN_idx = ku_mmu_swap_out();
-            if (new_PFN_idx == -1) {
-                return -1;
-            }
+    ku_mmu_SPIN_UNLOCK(&tlb->lock);
+}
+
+// drops every entry of asid
+void ku_tlb_flush(ku_tlb* tlb, char asid) {
+    ku_mmu_SPIN_LOCK(&tlb->lock);
+    for (unsigned int i = 0; i < tlb->sets * tlb->ways; i++) {
+        if (tlb->entries[i].asid == asid) {
+            tlb->entries[i].valid = 0;
         }
-        ku_mmu_pmem_free_list[new_PFN_idx] = 1;
-        cur_pmde->entry = (new_PFN_idx << 2) | 1;
     }
+    ku_mmu_SPIN_UNLOCK(&tlb->lock);
+}
 
-    mask = 0b00001100; // PT_MASK
-    ku_pte* cur_pte = (ku_pte*)(ku_mmu_pmem_base_addr + ((cur_pmde->entry >> 2) * ku_mmu_PAGE_SIZE) + ((va & mask) >> 2));
-    if (cur_pte->entry == 0) {
-        int new_PFN_idx = ku_mmu_find_free_physical_page();
-        if (new_PFN_idx == -1) {
-            new_PFN_idx = ku_mmu_swap_out();
-            if (new_PFN_idx == -1) {
-                return -1;
-            }
-        }
-        ku_mmu_pmem_free_list[new_PFN_idx] = 1;
-        cur_pte->entry = (new_PFN_idx << 2) | 1;
-        ku_mmu_enQueue(&ku_mmu_demanded_page, cur_pte);
+// drops the entry of (asid, vpn) and the entry of the huge page holding vpn
+void ku_tlb_invalidate(ku_tlb* tlb, char asid, ku_mmu_vpn_t vpn) {
+    if (tlb->sets == 0) {
+        return;
     }
 
-    // check present bit
-    mask = 0b00000001;
-    unsigned char present_bit = cur_pte->entry & mask;
-    if (present_bit == 0) {
-        int new_PFN_idx = ku_mmu_swap_in(cur_pte->entry);
-        if (new_PFN_idx == -1) {
-            return -1;
+    ku_mmu_SPIN_LOCK(&tlb->lock);
+    for (int huge = 0; huge <= tlb->huge; huge++) {
+        ku_mmu_vpn_t key = huge? (vpn >> ku_mmu_LEVEL_BITS) | ku_tlb_HUGE : vpn;
+        ku_tlb_entry* set = ku_tlb_set(tlb, asid, key);
+        for (unsigned int i = 0; i < tlb->ways; i++) {
+            if (set[i].valid && set[i].asid == asid && set[i].vpn == key) {
+                set[i].valid = 0;
+            }
         }
-        ku_mmu_pmem_free_list[new_PFN_idx] = 1;
-        cur_pte->entry = (new_PFN_idx << 2) | 1;
-        ku_mmu_enQueue(&ku_mmu_demanded_page, cur_pte);
     }
+    ku_mmu_SPIN_UNLOCK(&tlb->lock);
+}
+
+
+ku_mmu_PCB* ku_mmu_create_process(char pid);
+int ku_mmu_alloc_physical_page();
+int ku_mmu_alloc_swap_page();
+int ku_mmu_exit(char pid);
+int ku_mmu_fork(char parent_pid, char child_pid);
+int ku_mmu_share(char pid_a, ku_mmu_va_t va_a, char pid_b, ku_mmu_va_t va_b);
+int ku_mmu_swap_out();
+void ku_mmu_balance();
+int ku_mmu_swap_out_from(ku_mmu_PCB* owner);
+int ku_mmu_swap_in(ku_mmu_entry_t pte, char pid, int may_evict);
+int ku_mmu_get_page(char pid, int may_evict);
+void ku_mmu_zero_page(int pfn);
+
+
+ku_pte* ku_mmu_pmem_base_addr; // physical memory base address
+ku_mmu_swap_dev ku_mmu_swap_space; // swap space, backed by a file
+const char* ku_mmu_swap_path; // swap file, set by the caller before ku_mmu_init. NULL uses an unlinked temporary file
+size_t ku_mmu_zswap; // budget of the compressed tier in bytes, set by the caller before ku_mmu_init. 0 turns it off
+
+ku_mmu_bitmap ku_mmu_pmem_free_list; // physical memory free list
+ku_mmu_bitmap ku_mmu_swap_space_free_list; // swap space free list
+
+unsigned int ku_mmu_pmem_free_list_size;
+unsigned int ku_mmu_swap_space_free_list_size;
+ku_mmu_slot* ku_mmu_slots; // under ku_mmu_swap_space_free_list.lock
 
+ku_mmu_table ku_mmu_running_process; // table of currently running processes
+ku_mmu_frame_list ku_mmu_demanded_page; // FIFO of pages that can be swap out
+ku_mmu_frame_list ku_mmu_idle_tables; // page tables with no present entry, they can be swapped out
+#define ku_mmu_TABLE_SHARE 8 // idle tables may keep up to 1/8 of the frames
+ku_tlb ku_mmu_tlb; // TLB of the cpu, configured by the caller before ku_mmu_init
+ku_tlb* ku_mmu_cpu_tlbs[ku_mmu_MAX_CPUS]; // per cpu TLBs in multi-cpu mode
+int ku_mmu_ncpus;
+pthread_mutex_t ku_mmu_policy_lock = PTHREAD_MUTEX_INITIALIZER; // replacement policy and ku_mmu_frames
 
+// switches to multi-cpu mode, tlbs[i] is the TLB of cpu i. call before the cpus start
+int ku_mmu_smp_init(ku_tlb* tlbs, int ncpus) {
+    if (ncpus < 1 || ncpus > ku_mmu_MAX_CPUS) {
+        return -1;
+    }
+    for (int i = 0; i < ncpus; i++) {
+        ku_mmu_cpu_tlbs[i] = &tlbs[i];
+    }
+    ku_mmu_ncpus = ncpus;
+    ku_mmu_smp = 1;
     return 0;
 }
 
-ku_mmu_PCB* ku_mmu_create_process(char pid) {
-    int new_PFN_begin = ku_mmu_find_free_physical_page();
-    if (new_PFN_begin == -1) {
-        new_PFN_begin = ku_mmu_swap_out();
-        if (new_PFN_begin == -1) {
-            return NULL;
-        }
+// drops every translation of pid from every cpu's TLB
+void ku_mmu_shootdown_asid(char pid) {
+    if (ku_mmu_ncpus == 0) {
+        ku_tlb_flush(&ku_mmu_tlb, pid);
+        return;
+    }
+    for (int i = 0; i < ku_mmu_ncpus; i++) {
+        ku_tlb_flush(ku_mmu_cpu_tlbs[i], pid);
+    }
+}
+
+// drops the translation of (pid, vpn) from every cpu's TLB
+void ku_mmu_shootdown(char pid, ku_mmu_vpn_t vpn) {
+    if (ku_mmu_ncpus == 0) {
+        ku_tlb_invalidate(&ku_mmu_tlb, pid, vpn);
+        return;
     }
+    for (int i = 0; i < ku_mmu_ncpus; i++) {
+        ku_tlb_invalidate(ku_mmu_cpu_tlbs[i], pid, vpn);
+    }
+}
 
-    ku_mmu_pmem_free_list[new_PFN_begin] = 1;
+// multi-cpu mode: a cpu translates an access, stores to its frame and references it between these two,
+// faults and context switches run outside as they may evict. does nothing on one cpu
+void ku_mmu_access_begin(ku_tlb* tlb) {
+    if (ku_mmu_smp) {
+        __atomic_add_fetch(&tlb->access, 1, __ATOMIC_SEQ_CST); // before the TLB lookup and the walk read
+    }
+}
 
-    int new_PFN_end = ku_mmu_find_free_physical_page();
-    if (new_PFN_end == -1) {
-        new_PFN_end = ku_mmu_swap_out();
-        if (new_PFN_end == -1) {
-            return NULL;
+void ku_mmu_access_end(ku_tlb* tlb) {
+    if (ku_mmu_smp) {
+        __atomic_add_fetch(&tlb->access, 1, __ATOMIC_RELEASE);
+    }
+}
+
+// waits for the accesses other cpus began before a page was unmapped and shot down, they may still
+// store to its frame. the frame is only written out or reused after. the caller is outside its own access
+void ku_mmu_shootdown_wait() {
+    unsigned int seen[ku_mmu_MAX_CPUS];
+    for (int i = 0; i < ku_mmu_ncpus; i++) { // an access begun after it sees the page unmapped
+        seen[i] = __atomic_fetch_add(&ku_mmu_cpu_tlbs[i]->access, 0, __ATOMIC_SEQ_CST);
+    }
+    for (int i = 0; i < ku_mmu_ncpus; i++) {
+        while ((seen[i] & 1) && __atomic_load_n(&ku_mmu_cpu_tlbs[i]->access, __ATOMIC_ACQUIRE) == seen[i]) {
+            sched_yield();
         }
     }
+}
 
-    ku_mmu_pmem_free_list[new_PFN_end] = 1;
+// first entry of the page table stored in frame pfn
+ku_pte* ku_mmu_frame_addr(int pfn) {
+    return (ku_pte*)((char*)ku_mmu_pmem_base_addr + (size_t)pfn * ku_mmu_PAGE_SIZE);
+}
 
-    int new_PFN_pdbr = ku_mmu_find_free_physical_page();
-    if (new_PFN_pdbr == -1) {
-        new_PFN_pdbr = ku_mmu_swap_out();
-        if (new_PFN_pdbr == -1) {
-            return NULL;
+// page walk of the simulated hardware, same contract as ku_traverse: 0 when va does not translate.
+// a huge PMD entry ends the walk one level early
+ku_mmu_va_t ku_mmu_walk(void* cr3, ku_mmu_va_t va, void* pmem) {
+    if (va == 0) {
+        return 0;
+    }
+
+    ku_pte* cur_table = (ku_pte*) cr3;
+    ku_mmu_entry_t entry = 0;
+    for (int level = 0; level < ku_mmu_LEVELS; level++) {
+        entry = __atomic_load_n(&cur_table[ku_mmu_INDEX(va, level)].entry, __ATOMIC_ACQUIRE);
+        if ((entry & 1) == 0) {
+            return 0;
+        }
+        if ((entry & ku_mmu_HUGE_BIT) != 0) {
+            if (level != ku_mmu_HUGE_LEVEL) {
+                return 0;
+            }
+            return ku_mmu_PA(ku_mmu_PTE_PFN(entry) + ku_mmu_INDEX(va, ku_mmu_LEVELS - 1), va);
         }
+        cur_table = (ku_pte*)((char*)pmem + (size_t)ku_mmu_PTE_PFN(entry) * ku_mmu_PAGE_SIZE);
     }
+    return ku_mmu_PA(ku_mmu_PTE_PFN(entry), va);
+}
 
-    ku_mmu_pmem_free_list[new_PFN_pdbr] = 1;
+ku_mmu_frame* ku_mmu_frames; // indexed by pfn
+unsigned int ku_mmu_clock; // advanced on every reference
+ku_mmu_policy* ku_mmu_replacement; // policy selected at ku_mmu_init
 
+unsigned long long ku_mmu_stat_faults;
+unsigned long long ku_mmu_stat_swap_ins;
+unsigned long long ku_mmu_stat_swap_outs;
+unsigned long long ku_mmu_stat_swap_writes; // pages queued for write back
+unsigned long long ku_mmu_stat_swap_clean; // clean pages dropped without a write
+unsigned long long ku_mmu_stat_swap_reads; // pages read from the file
+unsigned long long ku_mmu_stat_swap_batches; // batches written by the writer thread
+unsigned long long ku_mmu_stat_zswap_stores; // pages compressed into the tier
+unsigned long long ku_mmu_stat_zswap_rejects; // pages that compressed too poorly and went to the file
+unsigned long long ku_mmu_stat_zswap_loads; // reads served by the tier
+unsigned long long ku_mmu_stat_zswap_writebacks; // pages moved from the tier to the file to make room
+unsigned long long ku_mmu_stat_zswap_packed; // compressed bytes of the stored pages
+unsigned long long ku_mmu_stat_table_outs; // page table pages swapped out
+unsigned long long ku_mmu_stat_table_ins;
+unsigned long long ku_mmu_stat_exits;
+unsigned long long ku_mmu_stat_fault_around; // pages mapped next to a faulting page
+unsigned long long ku_mmu_stat_readahead; // pages mapped ahead of a detected stream
+unsigned long long ku_mmu_stat_prefetch_used; // prefetched pages referenced later, each one a fault saved
+unsigned long long ku_mmu_stat_prefetch_evicted; // prefetched pages evicted before any reference
+unsigned long long ku_mmu_stat_swap_steals; // slots taken from resident pages while swap was full
+unsigned long long ku_mmu_stat_forks;
+unsigned long long ku_mmu_stat_cow_copies; // shared frames copied on a write
+unsigned long long ku_mmu_stat_cow_reuses; // shared frames taken back by their last mapper without a copy
+unsigned long long ku_mmu_stat_shares; // pages mapped into another process by ku_mmu_share
+unsigned long long ku_mmu_stat_shared_evictions; // frames unmapped from more than one pte at once
+unsigned long long ku_mmu_stat_huge_faults; // faults served with a zero huge page
+unsigned long long ku_mmu_stat_huge_collapses; // full PT pages turned into huge pages
+unsigned long long ku_mmu_stat_huge_splits; // huge pages turned back into small pages
+unsigned long long ku_mmu_stat_local_evictions; // pages evicted by their own process at its limit
+unsigned long long ku_mmu_stat_suspensions;
+unsigned long long ku_mmu_stat_resumes;
+unsigned long long ku_mmu_stat_refused; // ku_run_proc calls of suspended processes
 
-    ku_mmu_PCB* new_process = ku_mmu_listInsert(&ku_mmu_running_process, pid);
-    new_process->pdbr = (ku_pte*)(ku_mmu_pmem_base_addr + new_PFN_pdbr*ku_mmu_PAGE_SIZE);
-    new_process->pfn_begin = new_PFN_begin;
-    new_process->pfn_end = new_PFN_end;
+ku_mmu_rmap_node* ku_mmu_rmap_nodes;
+unsigned int ku_mmu_rmap_size;
+int ku_mmu_rmap_free; // free nodes, chained through next
 
-    long long addr = (long long) new_process;
-    unsigned int first_half = (addr >> 32);
-    unsigned int second_half = (addr << 32) >> 32;
+unsigned long long ku_mmu_stat_queue_inserts; // replacement queue, updated under ku_mmu_policy_lock
+unsigned long long ku_mmu_stat_queue_evictions;
+unsigned long long ku_mmu_stat_queue_removes;
+unsigned long long ku_mmu_stat_queue_scans; // frames looked at by the policies to find victims
 
-    *((char*)ku_mmu_pmem_base_addr + new_PFN_begin*ku_mmu_PAGE_SIZE) = first_half;
-    *((char*)ku_mmu_pmem_base_addr + new_PFN_end*ku_mmu_PAGE_SIZE) = second_half;
+/*
+ * Fault latency, one histogram per fault type
+ * ku_page_fault is timed from entry to return, lock waits included. bucket i counts
+ * latencies in [2^i, 2^(i+1)) ns, bucket 0 also takes anything below 1 ns.
+ */
+#define ku_mmu_FAULT_MINOR 0 // zero page
+#define ku_mmu_FAULT_MAJOR 1 // read from swap
+#define ku_mmu_FAULT_SPURIOUS 2 // already present when the handler got to it
+#define ku_mmu_FAULT_COW 3 // write to a shared frame
+#define ku_mmu_FAULT_TYPES 4
+#define ku_mmu_HIST_BUCKETS 40
 
-    return new_process;
+typedef struct ku_mmu_hist {
+    unsigned long long count;
+    unsigned long long sum_ns;
+    unsigned long long buckets[ku_mmu_HIST_BUCKETS];
+} ku_mmu_hist;
+
+const char* ku_mmu_fault_names[ku_mmu_FAULT_TYPES] = { "minor", "major", "spurious", "cow" };
+ku_mmu_hist ku_mmu_fault_latency[ku_mmu_FAULT_TYPES];
+
+void ku_mmu_histAdd(ku_mmu_hist* hist, unsigned long long ns) {
+    int bucket = (ns > 1)? 63 - __builtin_clzll(ns) : 0;
+    if (bucket >= ku_mmu_HIST_BUCKETS) {
+        bucket = ku_mmu_HIST_BUCKETS - 1;
+    }
+    ku_mmu_count(&hist->count);
+    ku_mmu_add(&hist->sum_ns, ns);
+    ku_mmu_count(&hist->buckets[bucket]);
 }
 
-int ku_mmu_find_free_physical_page() {
-    for (int i = 1; i < ku_mmu_pmem_free_list_size; i++) {
-        if (ku_mmu_pmem_free_list[i] == 0) {
-            return i;
-        }
+/*
+ * Fault-around and readahead, both off by default. set by the caller before the first fault
+ * fault-around maps the unmapped or swapped neighbours of a faulting page inside its PT page,
+ * using free frames only. readahead follows a constant vpn stride per process and maps up to
+ * ku_mmu_readahead pages ahead, doubling the window while the stream goes on. it evicts only while
+ * fewer than 1/ku_mmu_PREFETCH_SHARE of the frames hold prefetched pages nobody touched yet.
+ */
+#define ku_mmu_PREFETCH_SHARE 8
+#define ku_mmu_READAHEAD_MIN 2
+
+unsigned int ku_mmu_fault_around; // window in pages, 0 or 1 turns it off
+unsigned int ku_mmu_readahead; // largest readahead window in pages, 0 turns it off
+
+/*
+ * Huge pages, off by default. set by the caller before the first fault, the 8-bit layout ignores it
+ * as ku_traverse does not know huge entries.
+ * a huge page is a PMD entry with ku_mmu_HUGE_BIT mapping an aligned run of ku_mmu_HUGE_PAGES frames,
+ * it is one page to the replacement policy and to the TLB.
+ *   1 : a PT page whose entries all map private pages of its process is collapsed into a huge page
+ *   2 : a fault under an empty PMD entry also maps a zero huge page, while a free run is left
+ * the PT page stays with the run, so demotion back to small pages never needs a frame. it happens
+ * when the policy evicts the huge page (one small page of it goes), and on fork and share.
+ */
+unsigned int ku_mmu_huge;
+#define ku_mmu_HUGE_MODE ((ku_mmu_GEOMETRY == 8)? 0 : ku_mmu_huge)
+
+/*
+ * Resident set control, off by default. set by the caller after ku_mmu_init, before the first fault.
+ * a process whose resident pages reach its limit evicts one of its own pages for its next fault
+ * instead of taking the victim of the global policy, so one scanning process can not push out the others.
+ * the limit is the smaller of its quota (ku_mmu_set_quota) and, with ku_mmu_pff set, the allowance of the
+ * page fault frequency controller: a fault less than ku_mmu_pff accesses of the process after its last one
+ * grows the allowance by an eighth, a fault more than ku_mmu_PFF_SHRINK times that apart shrinks it.
+ * a process whose working set fits stops faulting, so every ku_mmu_BALANCE accesses of all processes the
+ * allowance of one that went that long without a fault shrinks the same way.
+ * with ku_mmu_admission set, the limits of the running processes (resident pages for one without a limit)
+ * are kept within physical memory by suspending the lowest priority, longest running pid first. ku_run_proc
+ * refuses a suspended process and its pages are the first to be evicted. suspended processes are resumed,
+ * highest priority and longest waiting first, once their limit fits in all but 1/ku_mmu_ADMIT_RESERVE of
+ * physical memory again, a new process starts behind them. one that waited ku_mmu_ADMIT_SLICE accesses is
+ * rotated back in, suspending running ones of its priority or lower, at most once a slice. ku_mmu_resume
+ * rotates a pid in on request.
+ */
+unsigned int ku_mmu_pff; // target fault interval in accesses of the process, 0 turns the controller off
+unsigned int ku_mmu_admission;
+unsigned int ku_mmu_admission_epoch; // bumped on every suspension and resume, cpus check it before running a pid
+unsigned int ku_mmu_suspended; // number of suspended processes
+unsigned int ku_mmu_rotated; // ku_mmu_clock at the last rotation
+#define ku_mmu_PFF_MIN 8 // smallest allowance in pages
+#define ku_mmu_PFF_SHRINK 4
+#define ku_mmu_ADMIT_RESERVE 8
+#define ku_mmu_BALANCE 1024 // accesses of all processes between two runs of ku_mmu_balance
+#define ku_mmu_ADMIT_SLICE 16384 // accesses a suspended process waits before it is rotated back in
+
+
+void ku_mmu_frameListInit(ku_mmu_frame_list* plist) {
+    plist->head = -1;
+    plist->tail = -1;
+    plist->size = 0;
+}
+
+void ku_mmu_frameListPush(ku_mmu_frame_list* plist, int pfn) {
+    ku_mmu_frames[pfn].prev = plist->tail;
+    ku_mmu_frames[pfn].next = -1;
+    if (plist->tail == -1) {
+        plist->head = pfn;
+    }
+    else {
+        ku_mmu_frames[plist->tail].next = pfn;
     }
-    return -1; // no free page found
+    plist->tail = pfn;
+    plist->size++;
 }
 
-int ku_mmu_find_free_swap_page() {
-    for (int i = 1; i < ku_mmu_swap_space_free_list_size; i++) {
-        if (ku_mmu_swap_space_free_list[i] == 0) {
-            return i;
-        }
+void ku_mmu_frameListRemove(ku_mmu_frame_list* plist, int pfn) {
+    ku_mmu_frame* frame = &ku_mmu_frames[pfn];
+    if (frame->prev == -1) {
+        plist->head = frame->next;
+    }
+    else {
+        ku_mmu_frames[frame->prev].next = frame->next;
+    }
+    if (frame->next == -1) {
+        plist->tail = frame->prev;
+    }
+    else {
+        ku_mmu_frames[frame->next].prev = frame->prev;
     }
-    return -1; // no free page found;
+    plist->size--;
 }
 
-int ku_mmu_swap_out() {
-    ku_pte* target_pte = ku_mmu_deQueue(&ku_mmu_demanded_page);
-    if (target_pte == NULL) { // in case of too small physical memory was allocated
-        return -1;
+int ku_mmu_frameListPop(ku_mmu_frame_list* plist) {
+    int pfn = plist->head;
+    if (pfn != -1) {
+        ku_mmu_frameListRemove(plist, pfn);
     }
-    int new_SFN_idx = ku_mmu_find_free_swap_page();
-    if (new_SFN_idx == -1) { // in case of too small swap area was allocated
-        return -1;
+    return pfn;
+}
+
+unsigned int ku_mmu_tick() {
+    if (ku_mmu_smp) {
+        return __atomic_add_fetch(&ku_mmu_clock, 1, __ATOMIC_RELAXED);
     }
+    return ++ku_mmu_clock;
+}
 
-    ku_mmu_swap_space_free_list[new_SFN_idx] = 1;
-    char swap_entry = new_SFN_idx << 1 | 0;
-    int cur_pfn = (target_pte->entry >> 2);
-    target_pte->entry = swap_entry;
+// called by the cpu on every translated access of pid, plays the role of the hardware accessed and dirty bits
+// like the hardware bits they are set without locks, policies read accessed as a hint
+void ku_mmu_reference(int pfn, char pid, int write) {
+    ku_mmu_frame* frame = &ku_mmu_frames[pfn];
+    if (__atomic_load_n(&frame->huge, __ATOMIC_RELAXED)) {
+        frame = &ku_mmu_frames[pfn & ~(ku_mmu_HUGE_PAGES - 1)];
+    }
+    unsigned int stamp = ku_mmu_tick();
+    frame->accessed = 1;
+    frame->stamp = stamp;
+    ku_mmu_count(&ku_mmu_running_process.pcbs[(unsigned char)pid].stat.accesses);
+    if ((ku_mmu_pff || ku_mmu_admission) && stamp % ku_mmu_BALANCE == 0) {
+        ku_mmu_balance();
+    }
+    if (write) {
+        frame->dirty = 1;
+    }
+    if (frame->prefetched && __atomic_exchange_n(&frame->prefetched, 0, __ATOMIC_RELAXED)) {
+        ku_mmu_count(&ku_mmu_stat_prefetch_used);
+    }
+}
 
-    return cur_pfn;
+// caches the translation of va the walk found in frame pfn, a frame of a huge page caches all of it
+void ku_mmu_tlb_fill(ku_tlb* tlb, char pid, ku_mmu_va_t va, int pfn) {
+    if (__atomic_load_n(&ku_mmu_frames[pfn].huge, __ATOMIC_RELAXED)) {
+        ku_tlb_insert(tlb, pid, (ku_mmu_VPN(va) >> ku_mmu_LEVEL_BITS) | ku_tlb_HUGE, pfn & ~(ku_mmu_HUGE_PAGES - 1));
+    }
+    else {
+        ku_tlb_insert(tlb, pid, ku_mmu_VPN(va), pfn);
+    }
 }
 
-int ku_mmu_swap_in(unsigned char pte) {
-    unsigned char swap_space_offset = (pte & 0b11111110) >> 1;
+void* ku_mmu_swap_writer(void* arg) {
+    ku_mmu_swap_dev* dev = (ku_mmu_swap_dev*) arg;
+    struct iovec iov[ku_mmu_SWAP_BATCH];
+    int order[ku_mmu_SWAP_BATCH];
+    char failed[ku_mmu_SWAP_BATCH];
 
-    int new_PFN_idx = ku_mmu_find_free_physical_page();
-    if (new_PFN_idx == -1) {
-        new_PFN_idx = ku_mmu_swap_out();
-        if (new_PFN_idx == -1) {
+    pthread_mutex_lock(&dev->lock);
+    for (;;) {
+        while (dev->writing == NULL && !dev->stop) {
+            pthread_cond_wait(&dev->work, &dev->lock);
+        }
+        if (dev->writing == NULL) {
+            break;
+        }
+        ku_mmu_swap_batch* batch = dev->writing;
+        pthread_mutex_unlock(&dev->lock);
+
+        // sort by slot so runs of adjacent slots become one write
+        for (unsigned int i = 0; i < batch->count; i++) {
+            int j = i;
+            for (; j > 0 && batch->slots[order[j - 1]] > batch->slots[i]; j--) {
+                order[j] = order[j - 1];
+            }
+            order[j] = i;
+        }
+        for (unsigned int i = 0, run; i < batch->count; i += run) {
+            for (run = 0; i + run < batch->count &&
+                    batch->slots[order[i + run]] == batch->slots[order[i]] + run; run++) {
+                iov[run].iov_base = batch->data + (size_t)order[i + run] * ku_mmu_PAGE_SIZE;
+                iov[run].iov_len = ku_mmu_PAGE_SIZE;
+            }
+            // a short write goes on where it stopped, the pages it could not write are marked failed
+            struct iovec* left = iov;
+            int count = run;
+            off_t off = (off_t)batch->slots[order[i]] * ku_mmu_PAGE_SIZE;
+            while (count > 0) {
+                ssize_t n = pwritev(dev->fd, left, count, off);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    break;
+                }
+                off += n;
+                for (; count > 0 && (size_t)n >= left->iov_len; left++, count--) {
+                    n -= left->iov_len;
+                }
+                if (count > 0) {
+                    left->iov_base = (char*)left->iov_base + n;
+                    left->iov_len -= n;
+                }
+            }
+            for (unsigned int j = 0; j < run; j++) {
+                failed[order[i + j]] = j >= run - count;
+            }
+        }
+
+        pthread_mutex_lock(&dev->lock);
+        for (unsigned int i = 0; i < batch->count; i++) {
+            unsigned int slot = batch->slots[i];
+            dev->lost += failed[i] - dev->failed[slot];
+            dev->failed[slot] = failed[i];
+        }
+        batch->count = 0;
+        dev->writing = NULL;
+        ku_mmu_stat_swap_batches++;
+        pthread_cond_broadcast(&dev->done);
+    }
+    pthread_mutex_unlock(&dev->lock);
+    return NULL;
+}
+
+int ku_mmu_swapInit(ku_mmu_swap_dev* dev, const char* path, unsigned int nslots) {
+    if (path != NULL) {
+        dev->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    }
+    else {
+        char tmp[] = "/tmp/ku_swap.XXXXXX";
+        dev->fd = mkstemp(tmp);
+        if (dev->fd != -1) {
+            unlink(tmp);
+        }
+    }
+    if (dev->fd == -1 || ftruncate(dev->fd, (off_t)nslots * ku_mmu_PAGE_SIZE) != 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        dev->batches[i].count = 0;
+        dev->batches[i].data = (char*) malloc((size_t)ku_mmu_SWAP_BATCH * ku_mmu_PAGE_SIZE);
+        if (dev->batches[i].data == NULL) {
+            return -1;
+        }
+    }
+    dev->pending = (int*) malloc((size_t)nslots * sizeof(int));
+    if (dev->pending == NULL) {
+        return -1;
+    }
+    for (unsigned int i = 0; i < nslots; i++) {
+        dev->pending[i] = -1;
+    }
+    dev->failed = (char*) calloc(nslots, sizeof(char));
+    dev->lost = 0;
+    if (dev->failed == NULL) {
+        return -1;
+    }
+    dev->tier = NULL;
+    dev->tier_head = 0;
+    dev->tier_tail = 0;
+    dev->tier_pages = 0;
+    dev->tier_bytes = 0;
+    if (ku_mmu_zswap > 0) {
+        dev->tier = (ku_mmu_zswap_entry*) calloc(nslots, sizeof(ku_mmu_zswap_entry));
+        if (dev->tier == NULL) {
             return -1;
         }
     }
-    ku_mmu_swap_space_free_list[swap_space_offset] = 0;
+    dev->active = &dev->batches[0];
+    dev->writing = NULL;
+    dev->stop = 0;
+    pthread_mutex_init(&dev->lock, NULL);
+    pthread_cond_init(&dev->work, NULL);
+    pthread_cond_init(&dev->done, NULL);
+    return pthread_create(&dev->writer, NULL, ku_mmu_swap_writer, dev) == 0? 0 : -1;
+}
 
-    return new_PFN_idx;
-}
\ No newline at end of file
+// hands the active batch to the writer, waits while the writer is still busy. dev->lock is held
+void ku_mmu_swapSubmit(ku_mmu_swap_dev* dev) {
+    while (dev->writing != NULL) {
+        pthread_cond_wait(&dev->done, &dev->lock);
+    }
+    ku_mmu_swap_batch* batch = dev->active;
+    for (unsigned int i = 0; i < batch->count; i++) {
+        dev->pending[batch->slots[i]] = -1;
+    }
+    dev->writing = batch;
+    dev->active = (batch == &dev->batches[0])? &dev->batches[1] : &dev->batches[0];
+    pthread_cond_signal(&dev->work);
+}
+
+// LZ77 over one page: a byte below 0x80 is followed by that many + 1 literals, one above it is a match of
+// (byte & 0x7f) + 4 bytes at a 16-bit little endian distance back. returns the length, 0 if it exceeds cap
+unsigned int ku_mmu_lzCompress(const unsigned char* src, unsigned char* dst, unsigned int cap) {
+    unsigned short last[1 << ku_mmu_LZ_HASH_BITS]; // hash of 4 bytes -> position + 1 they were last seen at
+    unsigned int i = 0, lit = 0, out = 0;
+    memset(last, 0, sizeof(last));
+    for (;;) {
+        int match = 0;
+        unsigned int len = 0, ref = 0;
+        if (i + 4 <= ku_mmu_PAGE_SIZE) {
+            unsigned int v;
+            memcpy(&v, src + i, 4);
+            unsigned int h = (v * 2654435761u) >> (32 - ku_mmu_LZ_HASH_BITS);
+            ref = last[h];
+            last[h] = i + 1;
+            if (ref != 0 && memcmp(src + ref - 1, src + i, 4) == 0) {
+                ref--;
+                for (len = 4; i + len < ku_mmu_PAGE_SIZE && len < ku_mmu_LZ_MAX_MATCH && src[ref + len] == src[i + len]; len++);
+                match = 1;
+            }
+        }
+        if (!match && i < ku_mmu_PAGE_SIZE) {
+            i++;
+            continue;
+        }
+        while (lit < i) { // literals before the match or the end of the page
+            unsigned int n = (i - lit < 128)? i - lit : 128;
+            if (out + 1 + n > cap) {
+                return 0;
+            }
+            dst[out++] = n - 1;
+            memcpy(dst + out, src + lit, n);
+            out += n;
+            lit += n;
+        }
+        if (!match) {
+            return out;
+        }
+        if (out + 3 > cap) {
+            return 0;
+        }
+        dst[out++] = 0x80 | (len - 4);
+        dst[out++] = (i - ref) & 0xff;
+        dst[out++] = (i - ref) >> 8;
+        i += len;
+        lit = i;
+    }
+}
+
+int ku_mmu_lzDecompress(const unsigned char* src, unsigned int len, unsigned char* dst) {
+    unsigned int in = 0, out = 0;
+    while (in < len) {
+        unsigned int token = src[in++];
+        if (token < 0x80) {
+            memcpy(dst + out, src + in, token + 1);
+            in += token + 1;
+            out += token + 1;
+        }
+        else {
+            unsigned int dist = src[in] | (src[in + 1] << 8);
+            in += 2;
+            for (unsigned int n = 0; n < (token & 0x7f) + 4; n++, out++) { // may overlap, byte by byte
+                dst[out] = dst[out - dist];
+            }
+        }
+    }
+    return (out == ku_mmu_PAGE_SIZE)? 0 : -1;
+}
+
+// batch page to copy slot into, the slot is queued if it was not yet. dev->lock is held
+char* ku_mmu_swapQueue(ku_mmu_swap_dev* dev, unsigned int slot) {
+    int idx = dev->pending[slot];
+    if (idx == -1) { // a slot queued twice keeps only the newest copy
+        if (dev->active->count == ku_mmu_SWAP_BATCH) {
+            ku_mmu_swapSubmit(dev);
+        }
+        idx = dev->active->count++;
+        dev->active->slots[idx] = slot;
+        dev->pending[slot] = idx;
+    }
+    return dev->active->data + (size_t)idx * ku_mmu_PAGE_SIZE;
+}
+
+void ku_mmu_zswapUnlink(ku_mmu_swap_dev* dev, unsigned int slot) {
+    ku_mmu_zswap_entry* entry = &dev->tier[slot];
+    if (entry->prev != 0) {
+        dev->tier[entry->prev].next = entry->next;
+    }
+    else {
+        dev->tier_head = entry->next;
+    }
+    if (entry->next != 0) {
+        dev->tier[entry->next].prev = entry->prev;
+    }
+    else {
+        dev->tier_tail = entry->prev;
+    }
+}
+
+void ku_mmu_zswapLink(ku_mmu_swap_dev* dev, unsigned int slot) {
+    ku_mmu_zswap_entry* entry = &dev->tier[slot];
+    entry->prev = 0;
+    entry->next = dev->tier_head;
+    if (dev->tier_head != 0) {
+        dev->tier[dev->tier_head].prev = slot;
+    }
+    else {
+        dev->tier_tail = slot;
+    }
+    dev->tier_head = slot;
+}
+
+// forgets the compressed copy of slot if the tier has one. dev->lock is held
+void ku_mmu_zswapDrop(ku_mmu_swap_dev* dev, unsigned int slot) {
+    ku_mmu_zswap_entry* entry = &dev->tier[slot];
+    if (entry->data == NULL) {
+        return;
+    }
+    ku_mmu_zswapUnlink(dev, slot);
+    free(entry->data);
+    entry->data = NULL;
+    dev->tier_pages--;
+    dev->tier_bytes -= entry->len;
+}
+
+// stores a compressed page for slot, writing the least recently used pages back until it fits. dev->lock is held
+int ku_mmu_zswapStore(ku_mmu_swap_dev* dev, unsigned int slot, const unsigned char* packed, unsigned int len) {
+    if (len > ku_mmu_zswap) {
+        return -1;
+    }
+    while (dev->tier_bytes + len > ku_mmu_zswap) {
+        unsigned int victim = dev->tier_tail;
+        ku_mmu_zswap_entry* entry = &dev->tier[victim];
+        ku_mmu_lzDecompress(entry->data, entry->len, (unsigned char*)ku_mmu_swapQueue(dev, victim));
+        ku_mmu_zswapDrop(dev, victim);
+        ku_mmu_stat_zswap_writebacks++;
+    }
+    unsigned char* data = (unsigned char*) malloc(len);
+    if (data == NULL) {
+        return -1;
+    }
+    memcpy(data, packed, len);
+    dev->tier[slot].data = data;
+    dev->tier[slot].len = len;
+    ku_mmu_zswapLink(dev, slot);
+    dev->tier_pages++;
+    dev->tier_bytes += len;
+    ku_mmu_stat_zswap_stores++;
+    ku_mmu_stat_zswap_packed += len;
+    return 0;
+}
+
+// queues a copy of frame pfn for slot, or keeps it compressed in the tier
+void ku_mmu_swapWrite(ku_mmu_swap_dev* dev, unsigned int slot, int pfn) {
+    unsigned char packed[ku_mmu_PAGE_SIZE];
+    unsigned int len = 0;
+    if (dev->tier != NULL) { // compressed outside the lock, the frame is unmapped already
+        len = ku_mmu_lzCompress((unsigned char*)ku_mmu_frame_addr(pfn), packed, ku_mmu_PAGE_SIZE * 3 / 4);
+    }
+
+    pthread_mutex_lock(&dev->lock);
+    if (dev->tier != NULL) {
+        ku_mmu_zswapDrop(dev, slot);
+        if (len != 0 && ku_mmu_zswapStore(dev, slot, packed, len) == 0) {
+            pthread_mutex_unlock(&dev->lock); // an older copy queued for the file is shadowed by the tier
+            return;
+        }
+        ku_mmu_stat_zswap_rejects++;
+    }
+    memcpy(ku_mmu_swapQueue(dev, slot), (char*)ku_mmu_frame_addr(pfn), ku_mmu_PAGE_SIZE);
+    pthread_mutex_unlock(&dev->lock);
+}
+
+// 1 if slot is in the batch the writer is working on. dev->lock is held
+int ku_mmu_swapWriting(ku_mmu_swap_dev* dev, unsigned int slot) {
+    for (unsigned int i = 0; dev->writing != NULL && i < dev->writing->count; i++) {
+        if (dev->writing->slots[i] == slot) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// reads slot into the page at dst
+int ku_mmu_swapRead(ku_mmu_swap_dev* dev, unsigned int slot, char* dst) {
+    pthread_mutex_lock(&dev->lock);
+    if (dev->tier != NULL && dev->tier[slot].data != NULL) {
+        int ret = ku_mmu_lzDecompress(dev->tier[slot].data, dev->tier[slot].len, (unsigned char*)dst);
+        ku_mmu_zswapUnlink(dev, slot);
+        ku_mmu_zswapLink(dev, slot);
+        ku_mmu_stat_zswap_loads++;
+        pthread_mutex_unlock(&dev->lock);
+        return ret;
+    }
+    int idx = dev->pending[slot];
+    if (idx != -1) {
+        memcpy(dst, dev->active->data + (size_t)idx * ku_mmu_PAGE_SIZE, ku_mmu_PAGE_SIZE);
+        pthread_mutex_unlock(&dev->lock);
+        return 0;
+    }
+    while (ku_mmu_swapWriting(dev, slot)) {
+        pthread_cond_wait(&dev->done, &dev->lock);
+    }
+    int failed = dev->failed[slot];
+    pthread_mutex_unlock(&dev->lock);
+    if (failed) { // the page never reached the file, the fault fails instead of mapping what is there
+        return -1;
+    }
+
+    ku_mmu_count(&ku_mmu_stat_swap_reads);
+    if (pread(dev->fd, dst, ku_mmu_PAGE_SIZE, (off_t)slot * ku_mmu_PAGE_SIZE) != ku_mmu_PAGE_SIZE) {
+        return -1;
+    }
+    return 0;
+}
+
+// writes everything queued so far and waits for it. -1 if a page in the file is lost
+int ku_mmu_swapFlush(ku_mmu_swap_dev* dev) {
+    pthread_mutex_lock(&dev->lock);
+    if (dev->active->count > 0) {
+        ku_mmu_swapSubmit(dev);
+    }
+    while (dev->writing != NULL) {
+        pthread_cond_wait(&dev->done, &dev->lock);
+    }
+    int ret = (dev->lost > 0)? -1 : 0;
+    pthread_mutex_unlock(&dev->lock);
+    return ret;
+}
+
+void ku_mmu_swap_close() {
+    ku_mmu_swap_dev* dev = &ku_mmu_swap_space;
+    ku_mmu_swapFlush(dev);
+    pthread_mutex_lock(&dev->lock);
+    dev->stop = 1;
+    pthread_cond_signal(&dev->work);
+    pthread_mutex_unlock(&dev->lock);
+    pthread_join(dev->writer, NULL);
+    close(dev->fd);
+    for (unsigned int slot = dev->tier_head; slot != 0; slot = dev->tier[slot].next) {
+        free(dev->tier[slot].data);
+    }
+    free(dev->tier);
+    dev->tier = NULL;
+    free(dev->failed);
+    dev->failed = NULL;
+}
+
+// slot was just taken from the allocator or from a resident page, the caller holds its only use
+void ku_mmu_slotInit(unsigned int slot) {
+    ku_mmu_LOCK(&ku_mmu_swap_space_free_list.lock);
+    ku_mmu_slots[slot].refs = 1;
+    ku_mmu_slots[slot].frame = -1;
+    ku_mmu_slots[slot].shm = 0;
+    ku_mmu_UNLOCK(&ku_mmu_swap_space_free_list.lock);
+}
+
+// another pte points to slot
+void ku_mmu_slotGet(unsigned int slot) {
+    ku_mmu_LOCK(&ku_mmu_swap_space_free_list.lock);
+    ku_mmu_slots[slot].refs++;
+    ku_mmu_UNLOCK(&ku_mmu_swap_space_free_list.lock);
+}
+
+// drops one use of slot, it is free again after the last one
+void ku_mmu_slotPut(unsigned int slot) {
+    ku_mmu_LOCK(&ku_mmu_swap_space_free_list.lock);
+    if (--ku_mmu_slots[slot].refs == 0) {
+        ku_mmu_bitmapClear(&ku_mmu_swap_space_free_list, slot);
+        ku_mmu_swap_space_free_list.frees++;
+        if (ku_mmu_swap_space.tier != NULL) { // before the slot can be allocated again
+            pthread_mutex_lock(&ku_mmu_swap_space.lock);
+            ku_mmu_zswapDrop(&ku_mmu_swap_space, slot);
+            pthread_mutex_unlock(&ku_mmu_swap_space.lock);
+        }
+    }
+    ku_mmu_UNLOCK(&ku_mmu_swap_space_free_list.lock);
+}
+
+// 1 if nobody but the caller uses slot, its copy may then be overwritten
+int ku_mmu_slotPrivate(unsigned int slot) {
+    ku_mmu_LOCK(&ku_mmu_swap_space_free_list.lock);
+    int private = ku_mmu_slots[slot].refs == 1;
+    ku_mmu_UNLOCK(&ku_mmu_swap_space_free_list.lock);
+    return private;
+}
+
+// records which resident frame holds slot, -1 if none, and whether it is shared memory
+void ku_mmu_slotCache(unsigned int slot, int pfn, char shm) {
+    ku_mmu_LOCK(&ku_mmu_swap_space_free_list.lock);
+    ku_mmu_slots[slot].frame = pfn;
+    ku_mmu_slots[slot].shm = shm;
+    ku_mmu_UNLOCK(&ku_mmu_swap_space_free_list.lock);
+}
+
+// resident frame holding slot, -1 if none. shm tells if the slot is shared memory
+int ku_mmu_slotLookup(unsigned int slot, char* shm) {
+    ku_mmu_LOCK(&ku_mmu_swap_space_free_list.lock);
+    int pfn = ku_mmu_slots[slot].frame;
+    *shm = ku_mmu_slots[slot].shm;
+    ku_mmu_UNLOCK(&ku_mmu_swap_space_free_list.lock);
+    return pfn;
+}
+
+
+// takes a free node off the pool, growing it if needed. -1 if memory ran out
+int ku_mmu_rmapAlloc() {
+    if (ku_mmu_rmap_free == -1) {
+        unsigned int size = (ku_mmu_rmap_size > 0)? ku_mmu_rmap_size * 2 : 64;
+        ku_mmu_rmap_node* nodes = (ku_mmu_rmap_node*) realloc(ku_mmu_rmap_nodes, size * sizeof(ku_mmu_rmap_node));
+        if (nodes == NULL) {
+            return -1;
+        }
+        for (unsigned int i = ku_mmu_rmap_size; i < size; i++) {
+            nodes[i].next = (i + 1 < size)? (int)i + 1 : -1;
+        }
+        ku_mmu_rmap_free = ku_mmu_rmap_size;
+        ku_mmu_rmap_nodes = nodes;
+        ku_mmu_rmap_size = size;
+    }
+    int node = ku_mmu_rmap_free;
+    ku_mmu_rmap_free = ku_mmu_rmap_nodes[node].next;
+    return node;
+}
+
+// a frame used by more than one pte is read-only unless it is shared memory. ptes swapped out to
+// the slot the frame holds still use it too
+void ku_mmu_rmapProtect(ku_mmu_frame* frame) {
+    char cow = !frame->shm && (frame->refs > 1 ||
+        (frame->refs == 1 && frame->swap != 0 && !ku_mmu_slotPrivate(frame->swap)));
+    if (frame->cow && !cow && frame->refs == 1) {
+        ku_mmu_count(&ku_mmu_stat_cow_reuses);
+    }
+    __atomic_store_n(&frame->cow, cow, __ATOMIC_RELEASE);
+}
+
+// pte of pid maps frame pfn as well, returns -1 if no node could be had
+int ku_mmu_rmapAdd(int pfn, ku_pte* pte, char pid, ku_mmu_vpn_t vpn) {
+    ku_mmu_frame* frame = &ku_mmu_frames[pfn];
+    if (frame->pte == NULL) {
+        frame->pte = pte;
+        frame->pid = pid;
+        frame->vpn = vpn;
+    }
+    else {
+        int node = ku_mmu_rmapAlloc();
+        if (node == -1) {
+            return -1;
+        }
+        ku_mmu_rmap_nodes[node].pte = pte;
+        ku_mmu_rmap_nodes[node].pid = pid;
+        ku_mmu_rmap_nodes[node].vpn = vpn;
+        ku_mmu_rmap_nodes[node].next = frame->rmap;
+        frame->rmap = node;
+    }
+    frame->refs++;
+    ku_mmu_rmapProtect(frame);
+    return 0;
+}
+
+// takes the first mapper off frame pfn into mapper, the next one becomes first. -1 if there is none
+// cow is left to the caller
+int ku_mmu_rmapPop(int pfn, ku_mmu_rmap_node* mapper) {
+    ku_mmu_frame* frame = &ku_mmu_frames[pfn];
+    if (frame->pte == NULL) {
+        return -1;
+    }
+    mapper->pte = frame->pte;
+    mapper->pid = frame->pid;
+    mapper->vpn = frame->vpn;
+    frame->pte = NULL;
+    frame->refs--;
+
+    int node = frame->rmap;
+    if (node != -1) {
+        frame->pte = ku_mmu_rmap_nodes[node].pte;
+        frame->pid = ku_mmu_rmap_nodes[node].pid;
+        frame->vpn = ku_mmu_rmap_nodes[node].vpn;
+        frame->rmap = ku_mmu_rmap_nodes[node].next;
+        ku_mmu_rmap_nodes[node].next = ku_mmu_rmap_free;
+        ku_mmu_rmap_free = node;
+    }
+    return 0;
+}
+
+// pte no longer maps frame pfn, returns the number of mappers left
+unsigned int ku_mmu_rmapRemove(int pfn, ku_pte* pte) {
+    ku_mmu_frame* frame = &ku_mmu_frames[pfn];
+    ku_mmu_rmap_node mapper;
+    if (frame->pte == pte) {
+        ku_mmu_rmapPop(pfn, &mapper);
+    }
+    else {
+        for (int* link = &frame->rmap; *link != -1; link = &ku_mmu_rmap_nodes[*link].next) {
+            int node = *link;
+            if (ku_mmu_rmap_nodes[node].pte == pte) {
+                *link = ku_mmu_rmap_nodes[node].next;
+                ku_mmu_rmap_nodes[node].next = ku_mmu_rmap_free;
+                ku_mmu_rmap_free = node;
+                frame->refs--;
+                break;
+            }
+        }
+    }
+    ku_mmu_rmapProtect(frame);
+    return frame->refs;
+}
+
+
+// FIFO: pages leave in the order they were brought in
+int ku_mmu_fifo_init(unsigned int nframes) {
+    ku_mmu_frameListInit(&ku_mmu_demanded_page);
+    return 0;
+}
+
+void ku_mmu_fifo_insert(int pfn) {
+    ku_mmu_frameListPush(&ku_mmu_demanded_page, pfn);
+}
+
+int ku_mmu_fifo_evict() {
+    ku_mmu_stat_queue_scans++;
+    return ku_mmu_frameListPop(&ku_mmu_demanded_page);
+}
+
+void ku_mmu_fifo_remove(int pfn) {
+    ku_mmu_frameListRemove(&ku_mmu_demanded_page, pfn);
+}
+
+
+// CLOCK: sweeps the frames, a referenced page gets a second chance
+unsigned int ku_mmu_clock_hand;
+
+int ku_mmu_clock_init(unsigned int nframes) {
+    ku_mmu_clock_hand = 0;
+    return 0;
+}
+
+void ku_mmu_clock_insert(int pfn) {
+}
+
+void ku_mmu_clock_remove(int pfn) {
+}
+
+int ku_mmu_clock_evict() {
+    for (unsigned int i = 0; i < 2 * ku_mmu_pmem_free_list_size; i++) {
+        int pfn = ku_mmu_clock_hand;
+        ku_mmu_frame* frame = &ku_mmu_frames[pfn];
+        ku_mmu_clock_hand = (ku_mmu_clock_hand + 1) % ku_mmu_pmem_free_list_size;
+        ku_mmu_stat_queue_scans++;
+
+        if (frame->pte == NULL || frame->pinned) {
+            continue;
+        }
+        if (frame->accessed) {
+            frame->accessed = 0;
+            continue;
+        }
+        return pfn;
+    }
+    return -1;
+}
+
+
+// LRU: approximated by sampling a few resident pages and taking the oldest reference
+#define ku_mmu_LRU_SAMPLES 5
+#define ku_mmu_LRU_PROBES 32
+
+unsigned int ku_mmu_lru_seed;
+
+int ku_mmu_lru_init(unsigned int nframes) {
+    ku_mmu_lru_seed = 1;
+    return 0;
+}
+
+void ku_mmu_lru_insert(int pfn) {
+}
+
+void ku_mmu_lru_remove(int pfn) {
+}
+
+int ku_mmu_lru_evict() {
+    int victim = -1;
+    int samples = 0;
+
+    for (int i = 0; i < ku_mmu_LRU_PROBES && samples < ku_mmu_LRU_SAMPLES; i++) {
+        ku_mmu_lru_seed = ku_mmu_lru_seed * 1103515245 + 12345;
+        int pfn = (ku_mmu_lru_seed >> 8) % ku_mmu_pmem_free_list_size;
+        ku_mmu_stat_queue_scans++;
+        if (ku_mmu_frames[pfn].pte == NULL || ku_mmu_frames[pfn].pinned) {
+            continue;
+        }
+        if (victim == -1 || ku_mmu_frames[pfn].stamp < ku_mmu_frames[victim].stamp) {
+            victim = pfn;
+        }
+        samples++;
+    }
+
+    if (victim == -1) { // resident pages are sparse, fall back to an exact scan
+        ku_mmu_stat_queue_scans += ku_mmu_pmem_free_list_size;
+        for (int pfn = 0; pfn < ku_mmu_pmem_free_list_size; pfn++) {
+            if (ku_mmu_frames[pfn].pte == NULL || ku_mmu_frames[pfn].pinned) {
+                continue;
+            }
+            if (victim == -1 || ku_mmu_frames[pfn].stamp < ku_mmu_frames[victim].stamp) {
+                victim = pfn;
+            }
+        }
+    }
+    return victim;
+}
+
+
+/*
+ * 2Q: first touch pages go to the A1in FIFO, pages evicted from A1in are remembered
+ * in the A1out ghost FIFO. a page faulted again while in A1out is hot and goes to Am,
+ * which is managed with second chance.
+ */
+#define ku_mmu_2Q_A1IN 1
+#define ku_mmu_2Q_AM 2
+
+typedef struct ku_mmu_ghost {
+    char valid;
+    char pid;
+    ku_mmu_vpn_t vpn;
+    int next; // bucket chain
+} ku_mmu_ghost;
+
+ku_mmu_frame_list ku_mmu_2q_a1in;
+ku_mmu_frame_list ku_mmu_2q_am;
+unsigned int ku_mmu_2q_kin; // A1in target size
+ku_mmu_ghost* ku_mmu_2q_a1out; // ring of kout ghosts
+unsigned int ku_mmu_2q_kout;
+unsigned int ku_mmu_2q_a1out_tail;
+int* ku_mmu_2q_buckets;
+unsigned int ku_mmu_2q_bucket_mask;
+
+int ku_mmu_2q_init(unsigned int nframes) {
+    ku_mmu_frameListInit(&ku_mmu_2q_a1in);
+    ku_mmu_frameListInit(&ku_mmu_2q_am);
+    ku_mmu_2q_kin = (nframes / 4 > 0)? nframes / 4 : 1;
+    ku_mmu_2q_kout = (nframes / 2 > 0)? nframes / 2 : 1;
+    ku_mmu_2q_a1out_tail = 0;
+
+    unsigned int nbuckets = 1;
+    while (nbuckets < ku_mmu_2q_kout) {
+        nbuckets <<= 1;
+    }
+    ku_mmu_2q_bucket_mask = nbuckets - 1;
+
+    ku_mmu_2q_a1out = (ku_mmu_ghost*) calloc(ku_mmu_2q_kout, sizeof(ku_mmu_ghost));
+    ku_mmu_2q_buckets = (int*) malloc(nbuckets * sizeof(int));
+    if (ku_mmu_2q_a1out == NULL || ku_mmu_2q_buckets == NULL) {
+        return -1;
+    }
+    for (unsigned int i = 0; i < nbuckets; i++) {
+        ku_mmu_2q_buckets[i] = -1;
+    }
+    return 0;
+}
+
+unsigned int ku_mmu_2q_hash(char pid, ku_mmu_vpn_t vpn) {
+    return (unsigned int)((unsigned char)pid * 31u + vpn * 2654435761u) & ku_mmu_2q_bucket_mask;
+}
+
+// unlinks the ghost of (pid, vpn), returns 1 if it was in A1out
+int ku_mmu_2q_ghostRemove(char pid, ku_mmu_vpn_t vpn) {
+    int* link = &ku_mmu_2q_buckets[ku_mmu_2q_hash(pid, vpn)];
+    while (*link != -1) {
+        ku_mmu_ghost* ghost = &ku_mmu_2q_a1out[*link];
+        if (ghost->pid == pid && ghost->vpn == vpn) {
+            ghost->valid = 0;
+            *link = ghost->next;
+            return 1;
+        }
+        link = &ghost->next;
+    }
+    return 0;
+}
+
+void ku_mmu_2q_ghostAdd(char pid, ku_mmu_vpn_t vpn) {
+    int slot = ku_mmu_2q_a1out_tail;
+    ku_mmu_ghost* ghost = &ku_mmu_2q_a1out[slot];
+    if (ghost->valid) { // A1out is full, forget the oldest ghost
+        // unlinked by slot, a page that changed mappers while resident can leave two ghosts of one key
+        int* link = &ku_mmu_2q_buckets[ku_mmu_2q_hash(ghost->pid, ghost->vpn)];
+        while (*link != slot) {
+            link = &ku_mmu_2q_a1out[*link].next;
+        }
+        *link = ghost->next;
+    }
+    ku_mmu_2q_a1out_tail = (ku_mmu_2q_a1out_tail + 1) % ku_mmu_2q_kout;
+
+    unsigned int bucket = ku_mmu_2q_hash(pid, vpn);
+    ghost->valid = 1;
+    ghost->pid = pid;
+    ghost->vpn = vpn;
+    ghost->next = ku_mmu_2q_buckets[bucket];
+    ku_mmu_2q_buckets[bucket] = slot;
+}
+
+void ku_mmu_2q_insert(int pfn) {
+    ku_mmu_frame* frame = &ku_mmu_frames[pfn];
+    if (ku_mmu_2q_ghostRemove(frame->pid, frame->vpn)) {
+        frame->list = ku_mmu_2Q_AM;
+        ku_mmu_frameListPush(&ku_mmu_2q_am, pfn);
+    }
+    else {
+        frame->list = ku_mmu_2Q_A1IN;
+        ku_mmu_frameListPush(&ku_mmu_2q_a1in, pfn);
+    }
+}
+
+int ku_mmu_2q_evict() {
+    ku_mmu_stat_queue_scans++;
+    if (ku_mmu_2q_a1in.size > ku_mmu_2q_kin || ku_mmu_2q_am.size == 0) {
+        int pfn = ku_mmu_frameListPop(&ku_mmu_2q_a1in);
+        if (pfn != -1) {
+            ku_mmu_2q_ghostAdd(ku_mmu_frames[pfn].pid, ku_mmu_frames[pfn].vpn);
+        }
+        return pfn;
+    }
+
+    for (unsigned int i = 0; i <= ku_mmu_2q_am.size; i++) {
+        int pfn = ku_mmu_frameListPop(&ku_mmu_2q_am);
+        ku_mmu_stat_queue_scans++;
+        if (!ku_mmu_frames[pfn].accessed) {
+            return pfn;
+        }
+        ku_mmu_frames[pfn].accessed = 0;
+        ku_mmu_frameListPush(&ku_mmu_2q_am, pfn);
+    }
+    return ku_mmu_frameListPop(&ku_mmu_2q_am);
+}
+
+void ku_mmu_2q_remove(int pfn) {
+    if (ku_mmu_frames[pfn].list == ku_mmu_2Q_AM) {
+        ku_mmu_frameListRemove(&ku_mmu_2q_am, pfn);
+    }
+    else {
+        ku_mmu_frameListRemove(&ku_mmu_2q_a1in, pfn);
+    }
+}
+
+
+ku_mmu_policy ku_mmu_policies[] = {
+    { "fifo", ku_mmu_fifo_init, ku_mmu_fifo_insert, ku_mmu_fifo_evict, ku_mmu_fifo_remove },
+    { "clock", ku_mmu_clock_init, ku_mmu_clock_insert, ku_mmu_clock_evict, ku_mmu_clock_remove },
+    { "lru", ku_mmu_lru_init, ku_mmu_lru_insert, ku_mmu_lru_evict, ku_mmu_lru_remove },
+    { "2q", ku_mmu_2q_init, ku_mmu_2q_insert, ku_mmu_2q_evict, ku_mmu_2q_remove }
+};
+
+// frame of the page table holding pte
+int ku_mmu_table_pfn(ku_pte* pte) {
+    return (int)(((char*)pte - (char*)ku_mmu_pmem_base_addr) / ku_mmu_PAGE_SIZE);
+}
+
+// the page table in frame pfn got a present entry or a walk holding it. caller holds ku_mmu_policy_lock
+void ku_mmu_pageTableRef(int pfn) {
+    ku_mmu_frame* table = &ku_mmu_frames[pfn];
+    if (table->present++ == 0 && table->parent != NULL) {
+        ku_mmu_frameListRemove(&ku_mmu_idle_tables, pfn);
+    }
+}
+
+// the page table in frame pfn lost a present entry or a walk holding it. caller holds ku_mmu_policy_lock
+void ku_mmu_pageTableUnref(int pfn) {
+    ku_mmu_frame* table = &ku_mmu_frames[pfn];
+    if (--table->present == 0 && table->parent != NULL) {
+        ku_mmu_frameListPush(&ku_mmu_idle_tables, pfn);
+    }
+}
+
+// lets go of the page tables ku_mmu_leaf_pte held on the way to leaf
+void ku_mmu_leaf_release(ku_pte* leaf) {
+    ku_mmu_LOCK(&ku_mmu_policy_lock);
+    for (int pfn = ku_mmu_table_pfn(leaf); ku_mmu_frames[pfn].parent != NULL; ) {
+        ku_pte* parent = ku_mmu_frames[pfn].parent;
+        ku_mmu_pageTableUnref(pfn);
+        pfn = ku_mmu_table_pfn(parent);
+    }
+    ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+}
+
+// frame pfn now holds a page table of pid with no present entry, parent gets to point to it
+// the table starts out held by the walk that brought it in
+void ku_mmu_table_attach(int pfn, ku_pte* parent, char pid) {
+    ku_mmu_frame* table = &ku_mmu_frames[pfn];
+    ku_mmu_LOCK(&ku_mmu_policy_lock);
+    table->parent = parent;
+    table->pid = pid;
+    table->present = 1;
+    ku_mmu_pageTableRef(ku_mmu_table_pfn(parent));
+    parent->entry = ku_mmu_PTE(pfn);
+    ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+}
+
+// swaps out an idle page table and returns its frame, -1 if none
+// multi-cpu mode never does it, cpus walk page tables without any lock
+int ku_mmu_reclaim_table() {
+    if (ku_mmu_smp || ku_mmu_idle_tables.size == 0) {
+        return -1;
+    }
+    int slot = ku_mmu_alloc_swap_page();
+    if (slot == -1) {
+        return -1;
+    }
+
+    int pfn = ku_mmu_frameListPop(&ku_mmu_idle_tables);
+    if (pfn == -1) { // the stealing of a swap slot may have made a table busy
+        ku_mmu_slotPut(slot);
+        return -1;
+    }
+
+    ku_mmu_frame* table = &ku_mmu_frames[pfn];
+    ku_mmu_swapWrite(&ku_mmu_swap_space, slot, pfn);
+    table->parent->entry = ku_mmu_PTE_SWAP(slot);
+    ku_mmu_pageTableUnref(ku_mmu_table_pfn(table->parent));
+    table->parent = NULL;
+    ku_mmu_stat_table_outs++;
+    return pfn;
+}
+
+// makes pfn a resident page of pid and hands it to the replacement policy. caller holds ku_mmu_policy_lock
+void ku_mmu_trackLocked(int pfn, ku_pte* pte, char pid, ku_mmu_va_t va, char prefetched) {
+    ku_mmu_frame* frame = &ku_mmu_frames[pfn];
+    ku_mmu_pageTableRef(ku_mmu_table_pfn(pte));
+    frame->pte = pte;
+    frame->refs = 1;
+    frame->pid = pid;
+    frame->vpn = ku_mmu_VPN(va);
+    frame->accessed = 0;
+    frame->dirty = 0;
+    frame->prefetched = prefetched;
+    frame->stamp = ku_mmu_tick();
+    ku_mmu_replacement->insert(pfn);
+    ku_mmu_stat_queue_inserts++;
+    ku_mmu_running_process.pcbs[(unsigned char)pid].stat.rss++;
+}
+
+void ku_mmu_track_page(int pfn, ku_pte* pte, char pid, ku_mmu_va_t va, char prefetched) {
+    ku_mmu_LOCK(&ku_mmu_policy_lock);
+    ku_mmu_trackLocked(pfn, pte, pid, va, prefetched);
+    ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+}
+
+// maps the page swapped out to the slot of entry at pte, with pfn holding a copy read from the slot.
+// a frame another pte of the slot brought back already is mapped instead. returns the pfn that got
+// mapped, -1 if pfn is -1 and the page is not resident
+int ku_mmu_swap_map(ku_pte* pte, ku_mmu_entry_t entry, char pid, ku_mmu_va_t va, int pfn, char prefetched) {
+    unsigned int slot = ku_mmu_PTE_SFN(entry);
+    char shm;
+    ku_mmu_LOCK(&ku_mmu_policy_lock);
+    int resident = ku_mmu_slotLookup(slot, &shm);
+    if (resident != -1) {
+        if (ku_mmu_rmapAdd(resident, pte, pid, ku_mmu_VPN(va)) != 0) {
+            ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+            return -1;
+        }
+        ku_mmu_pageTableRef(ku_mmu_table_pfn(pte));
+        ku_mmu_running_process.pcbs[(unsigned char)pid].stat.rss++;
+        __atomic_store_n(&pte->entry, ku_mmu_PTE(resident), __ATOMIC_RELEASE);
+        ku_mmu_slotPut(slot); // the frame keeps its own use of the slot
+        ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+        return resident;
+    }
+    if (pfn == -1) {
+        ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+        return -1;
+    }
+
+    // the slot stays with the page, a clean page is dropped without writing it again
+    ku_mmu_frames[pfn].swap = slot;
+    ku_mmu_frames[pfn].shm = shm;
+    ku_mmu_slotCache(slot, pfn, shm);
+    __atomic_store_n(&pte->entry, ku_mmu_PTE(pfn), __ATOMIC_RELEASE);
+    ku_mmu_shootdown(pid, ku_mmu_VPN(va));
+    ku_mmu_trackLocked(pfn, pte, pid, va, prefetched);
+    ku_mmu_rmapProtect(&ku_mmu_frames[pfn]);
+    ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+    return pfn;
+}
+
+// makes the run of frames starting at head a resident huge page of pid mapped at pmd, table is the
+// PT page kept for it. caller holds ku_mmu_policy_lock
+void ku_mmu_huge_track(int head, ku_pte* pmd, char pid, ku_mmu_vpn_t vpn, int table) {
+    for (int i = 0; i < ku_mmu_HUGE_PAGES; i++) {
+        __atomic_store_n(&ku_mmu_frames[head + i].huge, 1, __ATOMIC_RELAXED);
+    }
+    ku_mmu_frame* frame = &ku_mmu_frames[head];
+    frame->pte = pmd;
+    frame->refs = 1;
+    frame->pid = pid;
+    frame->vpn = vpn;
+    frame->accessed = 0;
+    frame->dirty = 0;
+    frame->prefetched = 0;
+    frame->swap = 0;
+    frame->table = table;
+    frame->stamp = ku_mmu_tick();
+    ku_mmu_replacement->insert(head);
+    ku_mmu_stat_queue_inserts++;
+}
+
+// maps the frames of the huge page starting at head as small pages through its PT page again. they
+// all join the replacement queue but head, which the caller evicts or queues. caller holds ku_mmu_policy_lock
+void ku_mmu_huge_split(int head) {
+    ku_mmu_frame* frame = &ku_mmu_frames[head];
+    ku_pte* pmd = frame->pte;
+    int table = frame->table;
+    ku_pte* pt = ku_mmu_frame_addr(table);
+
+    for (int i = 0; i < ku_mmu_HUGE_PAGES; i++) {
+        ku_mmu_frame* small = &ku_mmu_frames[head + i];
+        pt[i].entry = ku_mmu_PTE(head + i);
+        small->pte = &pt[i];
+        small->refs = 1;
+        small->pid = frame->pid;
+        small->vpn = frame->vpn + i;
+        small->accessed = frame->accessed;
+        small->dirty = frame->dirty;
+        small->prefetched = 0;
+        small->stamp = frame->stamp;
+        __atomic_store_n(&small->huge, 0, __ATOMIC_RELAXED);
+        if (i > 0) {
+            ku_mmu_replacement->insert(head + i);
+            ku_mmu_stat_queue_inserts++;
+        }
+    }
+    ku_mmu_frames[table].parent = pmd;
+    ku_mmu_frames[table].pid = frame->pid;
+    ku_mmu_frames[table].present = ku_mmu_HUGE_PAGES;
+    __atomic_store_n(&pmd->entry, ku_mmu_PTE(table), __ATOMIC_RELEASE);
+    ku_mmu_shootdown(frame->pid, frame->vpn); // drops the huge page from the TLBs
+    ku_mmu_count(&ku_mmu_stat_huge_splits);
+}
+
+// splits the huge page mapped at pmd in place. caller holds ku_mmu_policy_lock
+void ku_mmu_huge_demote(ku_pte* pmd) {
+    int head = ku_mmu_PTE_PFN(pmd->entry);
+    ku_mmu_replacement->remove(head);
+    ku_mmu_huge_split(head);
+    ku_mmu_replacement->insert(head);
+}
+
+// turns the PT page holding pte into a huge page if every entry maps a page of pid nobody else uses.
+// the pages are copied into a free run, their frames and swap copies are freed and the PT page is kept
+// for the demotion. runs after a fault of pid filled pte, the PCB lock of pid is held
+void ku_mmu_huge_collapse(char pid, ku_pte* pte) {
+    int table = ku_mmu_table_pfn(pte);
+    ku_pte* pt = ku_mmu_frame_addr(table);
+    ku_pte* pmd = ku_mmu_frames[table].parent;
+    int run = -1;
+
+    ku_mmu_LOCK(&ku_mmu_policy_lock);
+    if (pmd != NULL && ku_mmu_frames[table].present == ku_mmu_HUGE_PAGES) {
+        int i = 0;
+        for (; i < ku_mmu_HUGE_PAGES; i++) {
+            ku_mmu_entry_t entry = pt[i].entry;
+            if ((entry & 1) == 0) {
+                break;
+            }
+            ku_mmu_frame* frame = &ku_mmu_frames[ku_mmu_PTE_PFN(entry)];
+            if (frame->pte != &pt[i] || frame->refs != 1 || frame->cow || frame->shm || frame->pinned) {
+                break;
+            }
+        }
+        if (i == ku_mmu_HUGE_PAGES) {
+            run = ku_mmu_bitmapAllocRun(&ku_mmu_pmem_free_list, ku_mmu_HUGE_PAGES);
+        }
+    }
+    if (run == -1) {
+        ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+        return;
+    }
+
+    char accessed = 0;
+    ku_mmu_vpn_t vpn = ku_mmu_frames[ku_mmu_PTE_PFN(pt[0].entry)].vpn;
+    for (int i = 0; i < ku_mmu_HUGE_PAGES; i++) {
+        int pfn = ku_mmu_PTE_PFN(pt[i].entry);
+        ku_mmu_frame* frame = &ku_mmu_frames[pfn];
+        memcpy(ku_mmu_frame_addr(run + i), ku_mmu_frame_addr(pfn), ku_mmu_PAGE_SIZE);
+        accessed |= frame->accessed;
+        ku_mmu_replacement->remove(pfn);
+        ku_mmu_stat_queue_removes++;
+        if (frame->swap != 0) {
+            ku_mmu_slotCache(frame->swap, -1, 0);
+            ku_mmu_slotPut(frame->swap);
+        }
+        if (frame->prefetched && __atomic_exchange_n(&frame->prefetched, 0, __ATOMIC_RELAXED)) {
+            ku_mmu_count(&ku_mmu_stat_prefetch_used); // mapped for good now
+        }
+        frame->pte = NULL;
+        frame->refs = 0;
+        frame->swap = 0;
+        frame->dirty = 0;
+    }
+    ku_mmu_huge_track(run, pmd, pid, vpn, table);
+    ku_mmu_frames[run].accessed = accessed;
+    ku_mmu_frames[run].dirty = 1; // no swap copy is left
+    __atomic_store_n(&pmd->entry, ku_mmu_PTE(run) | ku_mmu_HUGE_BIT, __ATOMIC_RELEASE);
+    // the old frames are only reused once no TLB maps them
+    for (int i = 0; i < ku_mmu_HUGE_PAGES; i++) {
+        ku_mmu_shootdown(pid, vpn + i);
+        ku_mmu_bitmapFree(&ku_mmu_pmem_free_list, ku_mmu_PTE_PFN(pt[i].entry));
+    }
+    ku_mmu_frames[table].parent = NULL;
+    ku_mmu_frames[table].present = 0;
+    ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+    ku_mmu_count(&ku_mmu_stat_huge_collapses);
+}
+
+// drops the huge page starting at head of an exiting pid, with the PT page kept for it
+void ku_mmu_huge_free(int head, char pid) {
+    ku_mmu_frame* frame = &ku_mmu_frames[head];
+    ku_mmu_LOCK(&ku_mmu_policy_lock);
+    ku_mmu_running_process.pcbs[(unsigned char)pid].stat.rss -= ku_mmu_HUGE_PAGES;
+    ku_mmu_replacement->remove(head);
+    ku_mmu_stat_queue_removes++;
+    for (int i = 0; i < ku_mmu_HUGE_PAGES; i++) {
+        __atomic_store_n(&ku_mmu_frames[head + i].huge, 0, __ATOMIC_RELAXED);
+    }
+    int table = frame->table;
+    frame->pte = NULL;
+    frame->refs = 0;
+    frame->dirty = 0;
+    ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+    ku_mmu_bitmapFree(&ku_mmu_pmem_free_list, table);
+    ku_mmu_bitmapFreeRun(&ku_mmu_pmem_free_list, head, ku_mmu_HUGE_PAGES);
+}
+
+
+
+void* ku_mmu_init_policy(size_t pmem_size, size_t swap_size, ku_mmu_policy_type policy) {
+    ku_mmu_pmem_base_addr = (ku_pte*) calloc(1, pmem_size);
+
+    if (ku_mmu_pmem_base_addr == NULL) {
+        return 0;
+    }
+
+    ku_mmu_pmem_free_list_size = pmem_size / ku_mmu_PAGE_SIZE;
+    ku_mmu_swap_space_free_list_size = swap_size / ku_mmu_PAGE_SIZE;
+
+    if (ku_mmu_pmem_free_list_size > ku_mmu_MAX_PMEM_SIZE) {
+        ku_mmu_pmem_free_list_size = ku_mmu_MAX_PMEM_SIZE;
+    }
+    if (ku_mmu_swap_space_free_list_size > ku_mmu_MAX_SMEM_SIZE) {
+        ku_mmu_swap_space_free_list_size = ku_mmu_MAX_SMEM_SIZE;
+    }
+
+    if (ku_mmu_bitmapInit(&ku_mmu_pmem_free_list, ku_mmu_pmem_free_list_size) != 0 ||
+            ku_mmu_bitmapInit(&ku_mmu_swap_space_free_list, ku_mmu_swap_space_free_list_size) != 0) {
+        return 0;
+    }
+    ku_mmu_bitmapSet(&ku_mmu_pmem_free_list, 0); // Occupied by OS
+    ku_mmu_bitmapSet(&ku_mmu_swap_space_free_list, 0); // don't use
+    if (ku_mmu_swapInit(&ku_mmu_swap_space, ku_mmu_swap_path, ku_mmu_swap_space_free_list_size) != 0) {
+        return 0;
+    }
+    ku_mmu_slots = (ku_mmu_slot*) calloc(ku_mmu_swap_space_free_list_size + 1, sizeof(ku_mmu_slot));
+    if (ku_mmu_slots == NULL) {
+        return 0;
+    }
+
+    if (ku_mmu_tableInit(&ku_mmu_running_process) != 0) {
+        return 0;
+    }
+
+    ku_mmu_frames = (ku_mmu_frame*) calloc(ku_mmu_pmem_free_list_size, sizeof(ku_mmu_frame));
+    if (ku_mmu_frames == NULL) {
+        return 0;
+    }
+    for (unsigned int pfn = 0; pfn < ku_mmu_pmem_free_list_size; pfn++) {
+        ku_mmu_frames[pfn].rmap = -1;
+    }
+    ku_mmu_rmap_nodes = NULL;
+    ku_mmu_rmap_size = 0;
+    ku_mmu_rmap_free = -1;
+    ku_mmu_frameListInit(&ku_mmu_idle_tables);
+    ku_mmu_clock = 0;
+    ku_mmu_rotated = 0;
+    ku_mmu_stat_faults = 0;
+    ku_mmu_stat_swap_ins = 0;
+    ku_mmu_stat_swap_outs = 0;
+    ku_mmu_stat_swap_writes = 0;
+    ku_mmu_stat_swap_clean = 0;
+    ku_mmu_stat_swap_reads = 0;
+    ku_mmu_stat_swap_batches = 0;
+    ku_mmu_stat_zswap_stores = 0;
+    ku_mmu_stat_zswap_rejects = 0;
+    ku_mmu_stat_zswap_loads = 0;
+    ku_mmu_stat_zswap_writebacks = 0;
+    ku_mmu_stat_zswap_packed = 0;
+    ku_mmu_stat_table_outs = 0;
+    ku_mmu_stat_table_ins = 0;
+    ku_mmu_stat_exits = 0;
+    ku_mmu_stat_fault_around = 0;
+    ku_mmu_stat_readahead = 0;
+    ku_mmu_stat_prefetch_used = 0;
+    ku_mmu_stat_prefetch_evicted = 0;
+    ku_mmu_stat_swap_steals = 0;
+    ku_mmu_stat_forks = 0;
+    ku_mmu_stat_cow_copies = 0;
+    ku_mmu_stat_cow_reuses = 0;
+    ku_mmu_stat_shares = 0;
+    ku_mmu_stat_shared_evictions = 0;
+    ku_mmu_stat_huge_faults = 0;
+    ku_mmu_stat_huge_collapses = 0;
+    ku_mmu_stat_huge_splits = 0;
+    ku_mmu_stat_local_evictions = 0;
+    ku_mmu_stat_suspensions = 0;
+    ku_mmu_stat_resumes = 0;
+    ku_mmu_stat_refused = 0;
+    ku_mmu_stat_queue_inserts = 0;
+    ku_mmu_stat_queue_evictions = 0;
+    ku_mmu_stat_queue_removes = 0;
+    ku_mmu_stat_queue_scans = 0;
+    memset(ku_mmu_fault_latency, 0, sizeof(ku_mmu_fault_latency));
+    ku_mmu_replacement = &ku_mmu_policies[policy];
+    if (ku_mmu_replacement->init(ku_mmu_pmem_free_list_size) != 0) {
+        return 0;
+    }
+
+    return ku_mmu_pmem_base_addr;
+}
+
+void* ku_mmu_init(size_t pmem_size, size_t swap_size) {
+    return ku_mmu_init_policy(pmem_size, swap_size, ku_mmu_FIFO);
+}
+
+// resident pages pcb may keep, 0 for no limit
+unsigned int ku_mmu_limit(ku_mmu_PCB* pcb) {
+    unsigned int limit = pcb->allowance;
+    if (pcb->quota != 0 && (limit == 0 || pcb->quota < limit)) {
+        limit = pcb->quota;
+    }
+    return limit;
+}
+
+// frames pid may take from physical memory, 0 for no limit. pid need not exist yet
+int ku_mmu_set_quota(char pid, unsigned int pages) {
+    ku_mmu_running_process.pcbs[(unsigned char)pid].quota = pages;
+    return 0;
+}
+
+// admission control keeps higher priorities running, the default is 0
+int ku_mmu_set_priority(char pid, int priority) {
+    ku_mmu_running_process.pcbs[(unsigned char)pid].priority = priority;
+    return 0;
+}
+
+// returns 1 while pid is suspended by the admission control
+int ku_mmu_is_suspended(char pid) {
+    return __atomic_load_n(&ku_mmu_running_process.pcbs[(unsigned char)pid].suspended, __ATOMIC_ACQUIRE);
+}
+
+// accesses of all processes since pcb was created, suspended or resumed
+unsigned int ku_mmu_admitted_for(ku_mmu_PCB* pcb) {
+    return __atomic_load_n(&ku_mmu_clock, __ATOMIC_RELAXED) - pcb->admitted;
+}
+
+void ku_mmu_set_suspended(ku_mmu_PCB* pcb, char suspended) {
+    pcb->admitted = __atomic_load_n(&ku_mmu_clock, __ATOMIC_RELAXED);
+    __atomic_store_n(&pcb->suspended, suspended, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&ku_mmu_suspended, suspended? 1 : -1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&ku_mmu_admission_epoch, 1, __ATOMIC_RELEASE);
+    ku_mmu_count(suspended? &ku_mmu_stat_suspensions : &ku_mmu_stat_resumes);
+}
+
+// frames the running processes but skip claim: their limits, or resident pages for those without one.
+// running counts them. caller holds ku_mmu_policy_lock
+unsigned long long ku_mmu_demand(ku_mmu_PCB* skip, int* running) {
+    unsigned long long demand = 0;
+    *running = 0;
+    for (int i = 0; i < ku_mmu_MAX_PROC; i++) {
+        ku_mmu_PCB* pcb = &ku_mmu_running_process.pcbs[i];
+        if (pcb->used && !pcb->suspended && pcb != skip) {
+            unsigned int limit = ku_mmu_limit(pcb);
+            demand += limit? limit : pcb->stat.rss;
+            (*running)++;
+        }
+    }
+    return demand;
+}
+
+// running process of at most priority max to suspend next: the lowest priority, longest running one.
+// NULL if there is none. caller holds ku_mmu_policy_lock
+ku_mmu_PCB* ku_mmu_admit_victim(int max) {
+    ku_mmu_PCB* victim = NULL;
+    for (int i = 0; i < ku_mmu_MAX_PROC; i++) {
+        ku_mmu_PCB* pcb = &ku_mmu_running_process.pcbs[i];
+        if (!pcb->used || pcb->suspended || pcb->priority > max) {
+            continue;
+        }
+        if (victim == NULL || pcb->priority < victim->priority ||
+                (pcb->priority == victim->priority && ku_mmu_admitted_for(pcb) > ku_mmu_admitted_for(victim))) {
+            victim = pcb;
+        }
+    }
+    return victim;
+}
+
+// suspended process to resume next: the highest priority, longest waiting one. NULL if there is none.
+// caller holds ku_mmu_policy_lock
+ku_mmu_PCB* ku_mmu_admit_next() {
+    ku_mmu_PCB* next = NULL;
+    for (int i = 0; i < ku_mmu_MAX_PROC; i++) {
+        ku_mmu_PCB* pcb = &ku_mmu_running_process.pcbs[i];
+        if (!pcb->used || !pcb->suspended) {
+            continue;
+        }
+        if (next == NULL || pcb->priority > next->priority ||
+                (pcb->priority == next->priority && ku_mmu_admitted_for(pcb) > ku_mmu_admitted_for(next))) {
+            next = pcb;
+        }
+    }
+    return next;
+}
+
+// suspends the lowest priority processes while the demand of the running ones is over physical memory,
+// then resumes the highest priority ones that fit. caller holds ku_mmu_policy_lock
+void ku_mmu_admit() {
+    unsigned long long frames = ku_mmu_pmem_free_list_size;
+    int running;
+    unsigned long long demand = ku_mmu_demand(NULL, &running);
+
+    while (demand > frames && running > 1) {
+        ku_mmu_PCB* victim = ku_mmu_admit_victim(INT_MAX);
+        unsigned int limit = ku_mmu_limit(victim);
+        demand -= limit? limit : victim->stat.rss;
+        running--;
+        ku_mmu_set_suspended(victim, 1);
+    }
+
+    while (ku_mmu_suspended > 0) {
+        ku_mmu_PCB* next = ku_mmu_admit_next();
+        if (next == NULL) {
+            break;
+        }
+        unsigned int limit = ku_mmu_limit(next);
+        if (running > 0 && demand + limit > frames - frames / ku_mmu_ADMIT_RESERVE) {
+            break;
+        }
+        demand += limit;
+        running++;
+        ku_mmu_set_suspended(next, 0);
+    }
+}
+
+// resumes the suspended pcb, first suspending running processes of at most priority max, lowest priority
+// and longest running first, until its limit fits. nothing changes if they can not make room for it.
+// caller holds ku_mmu_policy_lock
+void ku_mmu_rotate(ku_mmu_PCB* pcb, int max) {
+    unsigned long long frames = ku_mmu_pmem_free_list_size;
+    unsigned long long room = frames - frames / ku_mmu_ADMIT_RESERVE;
+    unsigned int limit = ku_mmu_limit(pcb);
+    int running, movable = 0;
+    unsigned long long demand = ku_mmu_demand(NULL, &running), freeable = 0;
+
+    for (int i = 0; i < ku_mmu_MAX_PROC; i++) {
+        ku_mmu_PCB* other = &ku_mmu_running_process.pcbs[i];
+        if (other->used && !other->suspended && other->priority <= max) {
+            unsigned int other_limit = ku_mmu_limit(other);
+            freeable += other_limit? other_limit : other->stat.rss;
+            movable++;
+        }
+    }
+    if (running > movable && demand - freeable + limit > room) {
+        return;
+    }
+    ku_mmu_rotated = __atomic_load_n(&ku_mmu_clock, __ATOMIC_RELAXED);
+    while (running > 0 && demand + limit > room) {
+        ku_mmu_PCB* victim = ku_mmu_admit_victim(max);
+        if (victim == NULL) {
+            break;
+        }
+        unsigned int victim_limit = ku_mmu_limit(victim);
+        demand -= victim_limit? victim_limit : victim->stat.rss;
+        running--;
+        ku_mmu_set_suspended(victim, 1);
+    }
+    ku_mmu_set_suspended(pcb, 0);
+    ku_mmu_admit(); // frames left over go to the processes waiting next
+}
+
+// resumes pid if it is suspended, suspending other processes of any priority for it. for a caller that
+// holds work of pid back and has nothing else to run. 0, or -1 if pid does not exist
+int ku_mmu_resume(char pid) {
+    ku_mmu_PCB* pcb = &ku_mmu_running_process.pcbs[(unsigned char)pid];
+    int ret = 0;
+
+    ku_mmu_LOCK(&ku_mmu_policy_lock);
+    if (!pcb->used) {
+        ret = -1;
+    }
+    else if (pcb->suspended) {
+        ku_mmu_rotate(pcb, INT_MAX);
+    }
+    ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+    return ret;
+}
+
+// runs every ku_mmu_BALANCE accesses: faults alone never shrink the allowance of a process whose working set
+// fits, nor change anything for a suspended one. takes ku_mmu_policy_lock
+void ku_mmu_balance() {
+    int shrunk = 0;
+
+    ku_mmu_LOCK(&ku_mmu_policy_lock);
+    for (int i = 0; ku_mmu_pff && i < ku_mmu_MAX_PROC; i++) {
+        ku_mmu_PCB* pcb = &ku_mmu_running_process.pcbs[i];
+        if (!pcb->used || pcb->suspended || pcb->allowance <= ku_mmu_PFF_MIN) {
+            continue;
+        }
+        unsigned long long now = __atomic_load_n(&pcb->stat.accesses, __ATOMIC_RELAXED);
+        if (now - pcb->pff_last > (unsigned long long)ku_mmu_PFF_SHRINK * ku_mmu_pff) {
+            pcb->pff_last = now; // the next fault measures its interval from here
+            pcb->allowance -= pcb->allowance / 8 + 1;
+            if (pcb->allowance < ku_mmu_PFF_MIN) {
+                pcb->allowance = ku_mmu_PFF_MIN;
+            }
+            shrunk = 1;
+        }
+    }
+    if (ku_mmu_admission) {
+        if (shrunk) {
+            ku_mmu_admit();
+        }
+        ku_mmu_PCB* next = ku_mmu_suspended? ku_mmu_admit_next() : NULL;
+        unsigned int clock = __atomic_load_n(&ku_mmu_clock, __ATOMIC_RELAXED);
+        if (next != NULL && ku_mmu_admitted_for(next) >= ku_mmu_ADMIT_SLICE &&
+                clock - ku_mmu_rotated >= ku_mmu_ADMIT_SLICE) {
+            ku_mmu_rotate(next, next->priority);
+        }
+    }
+    ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+}
+
+// page fault frequency: faults close together at the allowance mean it is too small for the working set,
+// faults far apart that it holds pages the process no longer uses. runs under the PCB lock
+void ku_mmu_pff_update(ku_mmu_PCB* pcb) {
+    ku_mmu_LOCK(&ku_mmu_policy_lock); // ku_mmu_balance moves pff_last too
+    unsigned long long now = __atomic_load_n(&pcb->stat.accesses, __ATOMIC_RELAXED);
+    unsigned long long interval = now - pcb->pff_last;
+    pcb->pff_last = now;
+
+    unsigned int allowance = pcb->allowance;
+    if (allowance == 0) {
+        allowance = ku_mmu_PFF_MIN;
+    }
+    else if (interval < ku_mmu_pff) {
+        if (pcb->stat.rss >= allowance) { // below it, the faults are not for want of frames
+            allowance += allowance / 8 + 1;
+        }
+    }
+    else if (interval > (unsigned long long)ku_mmu_PFF_SHRINK * ku_mmu_pff) {
+        allowance -= allowance / 8 + 1;
+    }
+    if (allowance < ku_mmu_PFF_MIN) {
+        allowance = ku_mmu_PFF_MIN;
+    }
+    if (allowance > ku_mmu_pmem_free_list_size) {
+        allowance = ku_mmu_pmem_free_list_size;
+    }
+    if (allowance > pcb->allowance && !ku_mmu_admission) {
+        // without admission control a process only grows into frames no other process claims
+        int running;
+        unsigned long long others = ku_mmu_demand(pcb, &running);
+        unsigned long long free = (others < ku_mmu_pmem_free_list_size)? ku_mmu_pmem_free_list_size - others : 0;
+        if (allowance > free) {
+            allowance = (free > pcb->allowance)? (unsigned int)free : pcb->allowance;
+        }
+    }
+    if (allowance != pcb->allowance) {
+        pcb->allowance = allowance;
+        if (ku_mmu_admission) {
+            ku_mmu_admit();
+        }
+    }
+    ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+}
+
+// 1 if pcb has as many resident pages as its limit allows
+int ku_mmu_at_limit(ku_mmu_PCB* pcb) {
+    ku_mmu_LOCK(&ku_mmu_policy_lock);
+    unsigned int limit = ku_mmu_limit(pcb);
+    int full = limit != 0 && pcb->stat.rss >= limit;
+    ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+    return full;
+}
+
+// a page of owner to evict, found by a second chance sweep from its hand. pages other processes map
+// are left to the global policy. -1 if it has none. caller holds ku_mmu_policy_lock
+int ku_mmu_local_victim(ku_mmu_PCB* owner) {
+    int seen = 0;
+    if (owner->stat.rss == 0) {
+        return -1;
+    }
+    for (unsigned int i = 0; i < 2 * ku_mmu_pmem_free_list_size; i++) {
+        int pfn = owner->hand;
+        ku_mmu_frame* frame = &ku_mmu_frames[pfn];
+        owner->hand = (owner->hand + 1) % ku_mmu_pmem_free_list_size;
+        ku_mmu_stat_queue_scans++;
+
+        if (i == ku_mmu_pmem_free_list_size && !seen) {
+            return -1;
+        }
+        if (frame->pte == NULL || frame->pid != owner->pid || frame->refs != 1 || frame->pinned) {
+            continue;
+        }
+        seen = 1;
+        if (frame->accessed) {
+            frame->accessed = 0;
+            continue;
+        }
+        ku_mmu_replacement->remove(pfn);
+        ku_mmu_stat_queue_removes++;
+        return pfn;
+    }
+    return -1;
+}
+
+// 0, or -1 if pid can not be created. 1 if pid is suspended, it is not to be run then
+int ku_run_proc(char pid, struct ku_pte** ku_cr3) {
+
+    ku_mmu_LOCK(&ku_mmu_running_process.lock);
+    ku_mmu_PCB* cur_node = ku_mmu_tableSearch(&ku_mmu_running_process, pid);
+    if (cur_node == NULL) {
+        cur_node = ku_mmu_create_process(pid);
+        if (cur_node == NULL) {
+            ku_mmu_UNLOCK(&ku_mmu_running_process.lock);
+            return -1;
+        }
+    }
+    ku_mmu_UNLOCK(&ku_mmu_running_process.lock);
+
+    if (ku_mmu_is_suspended(pid)) {
+        ku_mmu_count(&ku_mmu_stat_refused);
+        return 1;
+    }
+    *ku_cr3 = cur_node->pdbr;
+
+    return 0;
+}
+
+int ku_mmu_handle_fault(ku_mmu_PCB* cur_node, char pid, ku_mmu_va_t va, int write);
+
+// the cpu checks a frame before writing to it, a shared frame is mapped read-only
+int ku_mmu_writable(int pfn) {
+    return !__atomic_load_n(&ku_mmu_frames[pfn].cow, __ATOMIC_ACQUIRE);
+}
+
+// page fault of pid at va, write is set when the cpu found the page present but not writable
+int ku_page_fault_rw(char pid, ku_mmu_va_t va, int write) {
+
+    ku_mmu_PCB* cur_node = ku_mmu_tableSearch(&ku_mmu_running_process, pid);
+    if (cur_node == NULL) {
+        return -1;
+    }
+    ku_mmu_count(&ku_mmu_stat_faults);
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    ku_mmu_LOCK(&cur_node->lock);
+    if (ku_mmu_pff && !write) {
+        ku_mmu_pff_update(cur_node);
+    }
+    int type = ku_mmu_handle_fault(cur_node, pid, va, write);
+    ku_mmu_UNLOCK(&cur_node->lock);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (type == -1) {
+        return -1;
+    }
+
+    ku_mmu_histAdd(&ku_mmu_fault_latency[type],
+        (end.tv_sec - begin.tv_sec) * 1000000000ULL + end.tv_nsec - begin.tv_nsec);
+    return 0;
+}
+
+int ku_page_fault(char pid, ku_mmu_va_t va) {
+    return ku_page_fault_rw(pid, va, 0);
+}
+
+/*
+ * Batched translation
+ * ku_translate_batch runs a stretch of reads and writes of a trace the way ku_cpu runs them one by one:
+ * TLB lookup, page walk, faults and the reference bits, in trace order. every pid is switched to once per
+ * batch, VPNs are computed for ku_mmu_BATCH_VPNS accesses at a time in a loop the compiler turns into vector
+ * shifts, an access to the page of the access before it reuses that translation, and the PT pages found by
+ * the walks are kept in a small cache so the next access under the same PT page reads one entry.
+ * a fault is resolved where it is met, as the addresses handed out before it must stay valid until the caller
+ * used them: the batch stops in front of a fault that could evict a page or free a frame, the next call
+ * starts with it. under memory pressure most calls stop early, so starting one only clears a few bitmaps.
+ */
+#define ku_mmu_BATCH_VPNS 64
+#define ku_mmu_BATCH_TABLE_BITS 8 // a batch remembers 1 << bits PT pages, direct mapped
+#define ku_mmu_BATCH_RETRY 2 // faults per access, a write may swap a shared page in and then copy it
+#define ku_mmu_BATCH_SMP_RETRY 16 // other cpus may evict the page again
+#define ku_mmu_BATCH_SWITCH -1 // ku_run_proc failed
+#define ku_mmu_BATCH_FAULT -2 // the fault handler failed
+#define ku_mmu_BATCH_UNMAPPED -3 // still not translated after the retries
+
+typedef struct ku_mmu_batch_table {
+    ku_pte* table;
+    ku_mmu_vpn_t tag; // vpn >> ku_mmu_LEVEL_BITS
+    char pid;
+} ku_mmu_batch_table;
+
+typedef struct ku_mmu_batch {
+    ku_mmu_batch_table tables[1 << ku_mmu_BATCH_TABLE_BITS];
+    unsigned long long filled[(1 << ku_mmu_BATCH_TABLE_BITS) / 64]; // slots of tables set by this batch
+    ku_pte* cr3s[ku_mmu_MAX_PROC];
+    unsigned long long switched[ku_mmu_MAX_PROC / 64]; // pids ku_run_proc was called for
+} ku_mmu_batch;
+
+#define ku_mmu_BIT_TEST(map, i) (((map)[(i) / 64] >> ((i) % 64)) & 1)
+#define ku_mmu_BIT_SET(map, i) ((map)[(i) / 64] |= 1ULL << ((i) % 64))
+
+// PT page of va, NULL if an entry on the way is not present or maps a huge page
+ku_pte* ku_mmu_walk_table(void* cr3, ku_mmu_va_t va, void* pmem) {
+    ku_pte* cur_table = (ku_pte*) cr3;
+    for (int level = 0; level < ku_mmu_LEVELS - 1; level++) {
+        ku_mmu_entry_t entry = __atomic_load_n(&cur_table[ku_mmu_INDEX(va, level)].entry, __ATOMIC_ACQUIRE);
+        if ((entry & 1) == 0 || (entry & ku_mmu_HUGE_BIT) != 0) {
+            return NULL;
+        }
+        cur_table = (ku_pte*)((char*)pmem + (size_t)ku_mmu_PTE_PFN(entry) * ku_mmu_PAGE_SIZE);
+    }
+    return cur_table;
+}
+
+// ku_mmu_walk through the PT pages of the batch. other cpus may swap tables out, they are not kept then
+ku_mmu_va_t ku_mmu_batch_walk(ku_mmu_batch* batch, char pid, ku_mmu_va_t va, ku_mmu_vpn_t vpn) {
+    if (va == 0) {
+        return 0;
+    }
+    void* cr3 = batch->cr3s[(unsigned char)pid];
+    ku_mmu_vpn_t tag = vpn >> ku_mmu_LEVEL_BITS;
+    // tags of neighbouring tables differ in their low bits only, fibonacci hashing spreads them
+    unsigned long long key = (unsigned long long)tag * ku_mmu_MAX_PROC + (unsigned char)pid;
+    unsigned int idx = (key * 0x9e3779b97f4a7c15ULL) >> (64 - ku_mmu_BATCH_TABLE_BITS);
+    ku_mmu_batch_table* slot = &batch->tables[idx];
+    ku_pte* table = slot->table;
+    if (!ku_mmu_BIT_TEST(batch->filled, idx) || slot->tag != tag || slot->pid != pid) {
+        table = ku_mmu_walk_table(cr3, va, ku_mmu_pmem_base_addr);
+        if (table == NULL) {
+            return ku_mmu_walk(cr3, va, ku_mmu_pmem_base_addr); // huge page or not present
+        }
+        if (!ku_mmu_smp) {
+            slot->table = table;
+            slot->tag = tag;
+            slot->pid = pid;
+            ku_mmu_BIT_SET(batch->filled, idx);
+        }
+    }
+    ku_mmu_entry_t entry = __atomic_load_n(&table[ku_mmu_INDEX(va, ku_mmu_LEVELS - 1)].entry, __ATOMIC_ACQUIRE);
+    return (entry & 1)? ku_mmu_PA(ku_mmu_PTE_PFN(entry), va) : 0;
+}
+
+// 1 if a fault of pid can be served from free frames without evicting, demoting or collapsing anything,
+// so every address handed out earlier in the batch still maps the same page
+int ku_mmu_batch_fault_safe(char pid) {
+    if (ku_mmu_smp || ku_mmu_HUGE_MODE || ku_mmu_pff || ku_mmu_limit(&ku_mmu_running_process.pcbs[(unsigned char)pid])) {
+        return 0;
+    }
+    ku_mmu_bitmap* pbm = &ku_mmu_pmem_free_list;
+    unsigned long long used = pbm->allocs - pbm->frees + 1; // frame 0 is set without an allocation
+    // the page, its page tables, a readahead window and the copy of a shared page the retry may write to
+    unsigned long long need = 2 + ku_mmu_LEVELS + ku_mmu_readahead;
+    return used + need <= pbm->size;
+}
+
+// ku_translate_batch, hits and misses count the TLB lookups of the accesses run, the caller adds them to tlb
+int ku_mmu_batch_run(ku_mmu_batch* batch, ku_tlb* tlb, const char* pids, const ku_mmu_va_t* vas,
+        const char* writes, size_t n, ku_mmu_va_t* pas, unsigned char* faults, size_t* done,
+        unsigned long long* hits, unsigned long long* misses) {
+    ku_mmu_vpn_t vpns[ku_mmu_BATCH_VPNS];
+    unsigned int epoch = __atomic_load_n(&ku_mmu_admission_epoch, __ATOMIC_ACQUIRE);
+    int recheck = 0;
+    int retries = ku_mmu_smp? ku_mmu_BATCH_SMP_RETRY : ku_mmu_BATCH_RETRY;
+    // translation of the access before, the TLB would hit it again. other cpus may shoot it down
+    int last_pfn = -1;
+    ku_mmu_vpn_t last_vpn = 0;
+    char last_pid = 0;
+
+    for (size_t base = 0; base < n; base += ku_mmu_BATCH_VPNS) {
+        size_t count = (n - base < ku_mmu_BATCH_VPNS)? n - base : ku_mmu_BATCH_VPNS;
+        for (size_t j = 0; j < count; j++) {
+            vpns[j] = ku_mmu_VPN(vas[base + j]);
+        }
+        memset(faults + base / 8, 0, (count + 7) / 8);
+
+        for (size_t j = 0; j < count; j++) {
+            size_t i = base + j;
+            unsigned char upid = pids[i];
+            char pid = pids[i];
+            ku_mmu_va_t va = vas[i];
+            int write = writes != NULL && writes[i];
+
+            // a suspension or resume may change which pids can run. on one cpu only switches, faults and the
+            // time slice of the admission control make them
+            if ((ku_mmu_smp || recheck || ku_mmu_admission) &&
+                    epoch != __atomic_load_n(&ku_mmu_admission_epoch, __ATOMIC_ACQUIRE)) {
+                epoch = __atomic_load_n(&ku_mmu_admission_epoch, __ATOMIC_ACQUIRE);
+                memset(batch->switched, 0, sizeof(batch->switched));
+            }
+            recheck = 0;
+            if (!ku_mmu_BIT_TEST(batch->switched, upid)) {
+                if (i > 0 && !ku_mmu_batch_fault_safe(pid)) {
+                    ku_mmu_LOCK(&ku_mmu_running_process.lock);
+                    ku_mmu_PCB* pcb = ku_mmu_tableSearch(&ku_mmu_running_process, pid);
+                    ku_mmu_UNLOCK(&ku_mmu_running_process.lock);
+                    if (pcb == NULL) { // its page directory may take the frame of a page handed out
+                        *done = i;
+                        return 0;
+                    }
+                }
+                last_pfn = -1; // creating pid may suspend others and evict their pages
+                if (i == 0) { // later on multi-cpu mode returned above for a pid to create
+                    ku_mmu_access_end(tlb);
+                }
+                int ret = ku_run_proc(pid, &batch->cr3s[upid]);
+                if (i == 0) {
+                    ku_mmu_access_begin(tlb);
+                }
+                if (ret == -1) {
+                    *done = i;
+                    return ku_mmu_BATCH_SWITCH;
+                }
+                if (ret == 1) { // the caller holds back the accesses from here on until pid is resumed
+                    pas[i] = 0;
+                    *done = i + 1;
+                    return 0;
+                }
+                ku_mmu_BIT_SET(batch->switched, upid);
+                recheck = 1;
+            }
+
+            ku_mmu_va_t pa = 0;
+            if (last_pfn >= 0 && vpns[j] == last_vpn && pid == last_pid && va != 0 &&
+                    (!write || ku_mmu_writable(last_pfn))) {
+                (*hits)++;
+                ku_mmu_reference(last_pfn, pid, write);
+                pas[i] = ku_mmu_PA(last_pfn, va);
+                continue;
+            }
+            int pfn = -1;
+            unsigned long long* counter = NULL; // the lookup is counted once the access runs
+            if (va != 0 && tlb->sets != 0) {
+                ku_mmu_SPIN_LOCK(&tlb->lock);
+                pfn = ku_tlb_find(tlb, pid, vpns[j]);
+                ku_mmu_SPIN_UNLOCK(&tlb->lock);
+                counter = (pfn >= 0)? hits : misses;
+            }
+            if (pfn >= 0 && (!write || ku_mmu_writable(pfn))) {
+                (*counter)++;
+                pa = ku_mmu_PA(pfn, va);
+            }
+            else {
+                pa = ku_mmu_batch_walk(batch, pid, va, vpns[j]);
+                int faulting = pa == 0 || (write && !ku_mmu_writable(ku_mmu_PA_PFN(pa)));
+                if (faulting && i > 0 && !ku_mmu_batch_fault_safe(pid)) { // the next batch runs the access
+                    *done = i;
+                    return 0;
+                }
+                if (counter != NULL) {
+                    (*counter)++;
+                }
+                for (int retry = 0; faulting; retry++) {
+                    int safe = ku_mmu_batch_fault_safe(pid);
+                    if (retry == retries) {
+                        *done = i;
+                        return ku_mmu_BATCH_UNMAPPED;
+                    }
+                    // multi-cpu mode only gets here for the first access, no address is handed out yet
+                    ku_mmu_access_end(tlb);
+                    int failed = ku_page_fault_rw(pid, va, pa != 0);
+                    ku_mmu_access_begin(tlb);
+                    if (failed) {
+                        *done = i;
+                        return ku_mmu_BATCH_FAULT;
+                    }
+                    faults[i / 8] |= 1 << (i % 8);
+                    recheck = 1;
+                    if (!safe) { // the fault may have swapped tables out
+                        memset(batch->filled, 0, sizeof(batch->filled));
+                    }
+                    pa = ku_mmu_batch_walk(batch, pid, va, vpns[j]);
+                    faulting = pa == 0 || (write && !ku_mmu_writable(ku_mmu_PA_PFN(pa)));
+                }
+                ku_mmu_tlb_fill(tlb, pid, va, ku_mmu_PA_PFN(pa));
+            }
+            ku_mmu_reference(ku_mmu_PA_PFN(pa), pid, write);
+            pas[i] = pa;
+            if (!ku_mmu_smp && tlb->sets != 0) {
+                last_pfn = ku_mmu_PA_PFN(pa);
+                last_vpn = vpns[j];
+                last_pid = pid;
+            }
+        }
+    }
+    *done = n;
+    return 0;
+}
+
+// translates the reads and writes (writes[i] != 0, writes may be NULL) of pids[i] at vas[i] through tlb,
+// faulting pages in and referencing them in order. pas[i] is the physical address, 0 for a pid suspended by
+// the admission control, which ends the batch after it. bit i of faults (n bits) is set if access i faulted.
+// *done is the number of accesses run, less than n if the batch stopped in front of a fault. returns 0, or
+// ku_mmu_BATCH_SWITCH, ku_mmu_BATCH_FAULT or ku_mmu_BATCH_UNMAPPED for access *done, whose fault bit tells
+// if it faulted before. the caller stores to the addresses before the next call, in multi-cpu mode it runs
+// the batch and the stores between ku_mmu_access_begin and ku_mmu_access_end of tlb
+int ku_translate_batch(ku_tlb* tlb, const char* pids, const ku_mmu_va_t* vas, const char* writes, size_t n,
+        ku_mmu_va_t* pas, unsigned char* faults, size_t* done) {
+    ku_mmu_batch batch;
+    unsigned long long hits = 0, misses = 0;
+
+    memset(batch.filled, 0, sizeof(batch.filled));
+    memset(batch.switched, 0, sizeof(batch.switched));
+    int ret = ku_mmu_batch_run(&batch, tlb, pids, vas, writes, n, pas, faults, done, &hits, &misses);
+    if (hits != 0 || misses != 0) {
+        ku_mmu_SPIN_LOCK(&tlb->lock);
+        tlb->hits += hits;
+        tlb->misses += misses;
+        ku_mmu_SPIN_UNLOCK(&tlb->lock);
+    }
+    return ret;
+}
+
+// pte of va in its page table at depth, missing PMD, PT, ... pages are allocated or swapped in on the way
+// down and huge pages on the way are demoted. NULL if no frame. the tables on the way are held so they
+// can not be swapped out, ku_mmu_leaf_release lets them go
+ku_pte* ku_mmu_table_entry(ku_mmu_PCB* cur_node, ku_mmu_va_t va, int depth, int may_evict) {
+    ku_pte* cur_table = cur_node->pdbr;
+    for (int level = 0; level < depth; level++) {
+        ku_pte* cur_pde = cur_table + ku_mmu_INDEX(va, level);
+        if ((cur_pde->entry & 1) == 0) {
+            int new_PFN_idx = ku_mmu_get_page(cur_node->pid, may_evict);
+            if (new_PFN_idx == -1) {
+                ku_mmu_leaf_release(cur_table);
+                return NULL;
+            }
+
+            if (cur_pde->entry == 0) {
+                ku_mmu_zero_page(new_PFN_idx);
+            }
+            else { // swapped out while none of its entries was present, they still are not
+                unsigned int slot = ku_mmu_PTE_SFN(cur_pde->entry);
+                if (ku_mmu_swapRead(&ku_mmu_swap_space, slot, (char*)ku_mmu_frame_addr(new_PFN_idx)) != 0) {
+                    ku_mmu_bitmapFree(&ku_mmu_pmem_free_list, new_PFN_idx);
+                    ku_mmu_leaf_release(cur_table);
+                    return NULL;
+                }
+                ku_mmu_slotPut(slot);
+                ku_mmu_stat_table_ins++;
+            }
+            ku_mmu_table_attach(new_PFN_idx, cur_pde, cur_node->pid);
+        }
+        else {
+            ku_mmu_LOCK(&ku_mmu_policy_lock);
+            if (ku_mmu_PTE_HUGE(cur_pde->entry)) {
+                ku_mmu_huge_demote(cur_pde);
+            }
+            ku_mmu_pageTableRef(ku_mmu_PTE_PFN(cur_pde->entry));
+            ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+        }
+        cur_table = ku_mmu_frame_addr(ku_mmu_PTE_PFN(cur_pde->entry));
+    }
+    return cur_table + ku_mmu_INDEX(va, depth);
+}
+
+ku_pte* ku_mmu_leaf_pte(ku_mmu_PCB* cur_node, ku_mmu_va_t va, int may_evict) {
+    return ku_mmu_table_entry(cur_node, va, ku_mmu_LEVELS - 1, may_evict);
+}
+
+// brings the page of va in: a zero page if it was never mapped, swap in if it was swapped out
+// returns the new pfn, 0 if the page was present already and -1 if no frame could be had.
+// major, if not NULL, is set when the page was read from swap
+int ku_mmu_populate(ku_pte* cur_pte, char pid, ku_mmu_va_t va, int may_evict, char prefetched, int* major) {
+    // other cpus may swap the page out under us so the entry is read once
+    ku_mmu_entry_t cur_entry = __atomic_load_n(&cur_pte->entry, __ATOMIC_ACQUIRE);
+    int new_PFN_idx;
+
+    if (cur_entry & 1) {
+        return 0;
+    }
+    if (cur_entry != 0) {
+        new_PFN_idx = ku_mmu_swap_map(cur_pte, cur_entry, pid, va, -1, prefetched);
+        if (new_PFN_idx != -1) { // another pte of the slot brought it back
+            return new_PFN_idx;
+        }
+        int pfn = ku_mmu_swap_in(cur_entry, pid, may_evict);
+        if (pfn == -1) {
+            return -1;
+        }
+        new_PFN_idx = ku_mmu_swap_map(cur_pte, cur_entry, pid, va, pfn, prefetched);
+        if (new_PFN_idx != pfn) { // another cpu was faster
+            ku_mmu_bitmapFree(&ku_mmu_pmem_free_list, pfn);
+        }
+        else if (major != NULL) {
+            *major = 1;
+        }
+        return new_PFN_idx;
+    }
+
+    new_PFN_idx = ku_mmu_get_page(pid, may_evict);
+    if (new_PFN_idx == -1) {
+        return -1;
+    }
+    ku_mmu_zero_page(new_PFN_idx);
+    __atomic_store_n(&cur_pte->entry, ku_mmu_PTE(new_PFN_idx), __ATOMIC_RELEASE);
+    ku_mmu_shootdown(pid, ku_mmu_VPN(va));
+    ku_mmu_track_page(new_PFN_idx, cur_pte, pid, va, prefetched);
+    return new_PFN_idx;
+}
+
+// maps a zero huge page at va if its PMD entry was never used and a free run is left.
+// returns ku_mmu_FAULT_MINOR, or -1 if a small page has to be mapped instead
+int ku_mmu_huge_fault(ku_mmu_PCB* cur_node, char pid, ku_mmu_va_t va) {
+    ku_pte* pmd = ku_mmu_table_entry(cur_node, va, ku_mmu_HUGE_LEVEL, 1);
+    if (pmd == NULL) {
+        return -1;
+    }
+
+    int ret = -1;
+    int run = (pmd->entry == 0)? ku_mmu_bitmapAllocRun(&ku_mmu_pmem_free_list, ku_mmu_HUGE_PAGES) : -1;
+    if (run != -1) {
+        int table = ku_mmu_get_page(pid, 1); // kept for the demotion
+        if (table == -1) {
+            ku_mmu_bitmapFreeRun(&ku_mmu_pmem_free_list, run, ku_mmu_HUGE_PAGES);
+        }
+        else {
+            memset((char*)ku_mmu_frame_addr(run), 0, (size_t)ku_mmu_HUGE_PAGES * ku_mmu_PAGE_SIZE);
+            ku_mmu_LOCK(&ku_mmu_policy_lock);
+            ku_mmu_frames[table].parent = NULL;
+            ku_mmu_frames[table].present = 0;
+            ku_mmu_frames[table].pid = pid;
+            ku_mmu_pageTableRef(ku_mmu_table_pfn(pmd));
+            ku_mmu_huge_track(run, pmd, pid, ku_mmu_VPN(va) & ~(ku_mmu_vpn_t)(ku_mmu_HUGE_PAGES - 1), table);
+            ku_mmu_running_process.pcbs[(unsigned char)pid].stat.rss += ku_mmu_HUGE_PAGES;
+            __atomic_store_n(&pmd->entry, ku_mmu_PTE(run) | ku_mmu_HUGE_BIT, __ATOMIC_RELEASE);
+            ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+            ku_mmu_count(&ku_mmu_stat_huge_faults);
+            cur_node->stat.minor_faults++;
+            ret = ku_mmu_FAULT_MINOR;
+        }
+    }
+    ku_mmu_leaf_release(pmd);
+    return ret;
+}
+
+// maps the neighbours of the faulting pte that share its window of the PT page
+void ku_mmu_fault_around_map(ku_pte* cur_pte, char pid, ku_mmu_va_t va) {
+    unsigned int entries = 1 << ku_mmu_LEVEL_BITS;
+    unsigned int idx = ku_mmu_INDEX(va, ku_mmu_LEVELS - 1);
+    unsigned int first = idx - idx % ku_mmu_fault_around;
+    unsigned int last = (first + ku_mmu_fault_around < entries)? first + ku_mmu_fault_around : entries;
+    ku_mmu_uva_t page_va = (ku_mmu_uva_t)va & ~(ku_mmu_uva_t)(ku_mmu_PAGE_SIZE - 1);
+
+    for (unsigned int i = first; i < last; i++) {
+        if (i == idx) {
+            continue;
+        }
+        ku_mmu_va_t around_va = (ku_mmu_va_t)(page_va + ((long long)i - idx) * ku_mmu_PAGE_SIZE);
+        int pfn = ku_mmu_populate(cur_pte + ((long long)i - idx), pid, around_va, 0, 1, NULL);
+        if (pfn == -1) { // out of free frames
+            return;
+        }
+        if (pfn != 0) {
+            ku_mmu_count(&ku_mmu_stat_fault_around);
+        }
+    }
+}
+
+// stride detector of cur_node, maps the pages the stream will touch next
+void ku_mmu_readahead_map(ku_mmu_PCB* cur_node, char pid, ku_mmu_va_t va) {
+    ku_mmu_vpn_t vpn = ku_mmu_VPN(va);
+    long long stride = (long long)vpn - (long long)cur_node->ra_last;
+    long long nvpns = 1LL << (ku_mmu_LEVELS * ku_mmu_LEVEL_BITS);
+
+    if (cur_node->ra_window > 0 && vpn == cur_node->ra_next) { // the stream ran past the pages read ahead
+        cur_node->ra_window *= 2;
+    }
+    else if (stride != 0 && stride == cur_node->ra_stride) { // same stride twice, a new stream
+        cur_node->ra_window = ku_mmu_READAHEAD_MIN;
+    }
+    else {
+        cur_node->ra_stride = stride;
+        cur_node->ra_window = 0;
+    }
+    cur_node->ra_last = vpn;
+    if (cur_node->ra_window > ku_mmu_readahead) {
+        cur_node->ra_window = ku_mmu_readahead;
+    }
+
+    stride = cur_node->ra_stride;
+    for (unsigned int i = 1; i <= cur_node->ra_window; i++) {
+        long long target = (long long)vpn + stride * i;
+        if (target < 0 || target >= nvpns) {
+            break;
+        }
+        unsigned long long pending = ku_mmu_stat_fault_around + ku_mmu_stat_readahead -
+            ku_mmu_stat_prefetch_used - ku_mmu_stat_prefetch_evicted;
+        int may_evict = pending < ku_mmu_pmem_free_list_size / ku_mmu_PREFETCH_SHARE;
+
+        ku_mmu_va_t target_va = (ku_mmu_va_t)((ku_mmu_uva_t)target << ku_mmu_PAGE_SHIFT);
+        if (ku_mmu_HUGE_MODE && ku_mmu_walk(cur_node->pdbr, target_va, ku_mmu_pmem_base_addr) != 0) {
+            continue; // present, a huge page is not demoted for it
+        }
+        ku_pte* target_pte = ku_mmu_leaf_pte(cur_node, target_va, 0);
+        if (target_pte == NULL) {
+            break;
+        }
+        int pfn = ku_mmu_populate(target_pte, pid, target_va, may_evict, 1, NULL);
+        ku_mmu_leaf_release(target_pte);
+        if (pfn == -1) {
+            break;
+        }
+        if (pfn != 0) {
+            ku_mmu_count(&ku_mmu_stat_readahead);
+        }
+    }
+    cur_node->ra_next = (ku_mmu_vpn_t)((long long)vpn + stride * (cur_node->ra_window + 1));
+}
+
+// write fault on the present page at cur_pte. a frame still shared copy-on-write is copied
+int ku_mmu_cow(ku_mmu_PCB* cur_node, ku_pte* cur_pte, char pid, ku_mmu_va_t va) {
+    int old_pfn = ku_mmu_PTE_PFN(cur_pte->entry);
+    ku_mmu_frame* old = &ku_mmu_frames[old_pfn];
+
+    ku_mmu_LOCK(&ku_mmu_policy_lock);
+    ku_mmu_rmapProtect(old);
+    if (!old->cow) { // the other users left meanwhile
+        ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+        return ku_mmu_FAULT_SPURIOUS;
+    }
+    if (old->refs == 1) { // only ptes swapped out share it, they read the slot again
+        ku_mmu_slotCache(old->swap, -1, 0);
+        ku_mmu_slotPut(old->swap);
+        old->swap = 0;
+        ku_mmu_rmapProtect(old);
+        ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+        cur_node->stat.cow_faults++;
+        return ku_mmu_FAULT_COW;
+    }
+
+    // pinned, finding a frame for the copy must not evict the page being copied
+    old->pinned = 1;
+    ku_mmu_replacement->remove(old_pfn);
+    ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+
+    int new_pfn = ku_mmu_get_page(pid, 1);
+    if (new_pfn != -1) {
+        memcpy(ku_mmu_frame_addr(new_pfn), ku_mmu_frame_addr(old_pfn), ku_mmu_PAGE_SIZE);
+    }
+
+    ku_mmu_LOCK(&ku_mmu_policy_lock);
+    old->pinned = 0;
+    ku_mmu_replacement->insert(old_pfn);
+    if (new_pfn == -1 || !old->cow) {
+        ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+        if (new_pfn == -1) {
+            return -1;
+        }
+        ku_mmu_bitmapFree(&ku_mmu_pmem_free_list, new_pfn);
+        return ku_mmu_FAULT_SPURIOUS;
+    }
+
+    ku_mmu_rmapRemove(old_pfn, cur_pte);
+    ku_mmu_frame* frame = &ku_mmu_frames[new_pfn];
+    frame->pte = cur_pte;
+    frame->refs = 1;
+    frame->pid = pid;
+    frame->vpn = ku_mmu_VPN(va);
+    frame->accessed = 0;
+    frame->dirty = 0;
+    frame->prefetched = 0;
+    frame->swap = 0;
+    frame->stamp = ku_mmu_tick();
+    ku_mmu_replacement->insert(new_pfn);
+    ku_mmu_stat_queue_inserts++;
+    __atomic_store_n(&cur_pte->entry, ku_mmu_PTE(new_pfn), __ATOMIC_RELEASE);
+    ku_mmu_shootdown(pid, ku_mmu_VPN(va));
+    ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+
+    ku_mmu_count(&ku_mmu_stat_cow_copies);
+    cur_node->stat.cow_faults++;
+    return ku_mmu_FAULT_COW;
+}
+
+// fault handling on the page tables of cur_node, its lock is held. returns the fault type or -1
+int ku_mmu_handle_fault(ku_mmu_PCB* cur_node, char pid, ku_mmu_va_t va, int write) {
+    if (ku_mmu_HUGE_MODE > 1 && !write) {
+        int type = ku_mmu_huge_fault(cur_node, pid, va);
+        if (type != -1) {
+            return type;
+        }
+    }
+
+    ku_pte* cur_pte = ku_mmu_leaf_pte(cur_node, va, 1);
+    if (cur_pte == NULL) {
+        return -1;
+    }
+
+    if (write && (__atomic_load_n(&cur_pte->entry, __ATOMIC_ACQUIRE) & 1)) {
+        int type = ku_mmu_cow(cur_node, cur_pte, pid, va);
+        ku_mmu_leaf_release(cur_pte);
+        return type;
+    }
+
+    // readahead may evict, so it runs before the faulting page is brought in and can not push it out
+    if (ku_mmu_readahead > 0) {
+        ku_mmu_readahead_map(cur_node, pid, va);
+    }
+    int major = 0;
+    int ret = ku_mmu_populate(cur_pte, pid, va, 1, 0, &major);
+    if (ret != -1 && ku_mmu_fault_around > 1) {
+        ku_mmu_fault_around_map(cur_pte, pid, va);
+    }
+    ku_mmu_leaf_release(cur_pte);
+
+    if (ret == -1) {
+        return -1;
+    }
+    if (ret == 0) {
+        return ku_mmu_FAULT_SPURIOUS;
+    }
+    if (ku_mmu_HUGE_MODE) {
+        ku_mmu_huge_collapse(pid, cur_pte);
+    }
+    if (!major) { // zero page, or brought back by another pte of its slot
+        cur_node->stat.minor_faults++;
+        return ku_mmu_FAULT_MINOR;
+    }
+    cur_node->stat.major_faults++;
+    return ku_mmu_FAULT_MAJOR;
+}
+
+ku_mmu_PCB* ku_mmu_create_process(char pid) {
+    int new_PFN_pdbr = ku_mmu_get_page(pid, 1);
+    if (new_PFN_pdbr == -1) {
+        return NULL;
+    }
+
+    ku_mmu_zero_page(new_PFN_pdbr);
+    ku_mmu_frames[new_PFN_pdbr].pid = pid;
+    ku_mmu_frames[new_PFN_pdbr].present = 0;
+    ku_mmu_LOCK(&ku_mmu_policy_lock);
+    ku_mmu_PCB* new_process = ku_mmu_tableInsert(&ku_mmu_running_process, pid);
+    new_process->pdbr = ku_mmu_frame_addr(new_PFN_pdbr);
+    new_process->admitted = __atomic_load_n(&ku_mmu_clock, __ATOMIC_RELAXED);
+    if (ku_mmu_admission) { // its quota may not fit
+        if (ku_mmu_suspended > 0) { // it waits behind the processes suspended before it
+            ku_mmu_set_suspended(new_process, 1);
+        }
+        ku_mmu_admit();
+    }
+    ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+
+    return new_process;
+}
+
+// drops the mapping of a resident page at pte by an exiting pid, the frame and the swap copy it may keep
+// are freed with the last mapper
+void ku_mmu_free_page(int pfn, ku_pte* pte, char pid) {
+    ku_mmu_frame* frame = &ku_mmu_frames[pfn];
+    ku_mmu_LOCK(&ku_mmu_policy_lock);
+    ku_mmu_running_process.pcbs[(unsigned char)pid].stat.rss--;
+    if (ku_mmu_rmapRemove(pfn, pte) > 0) { // other processes still map it
+        ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+        return;
+    }
+    ku_mmu_replacement->remove(pfn);
+    ku_mmu_stat_queue_removes++;
+    if (frame->swap != 0) {
+        // shared memory mappers swapped out earlier read the slot again, it must hold what was written since
+        if (frame->shm && frame->dirty && !ku_mmu_slotPrivate(frame->swap)) {
+            ku_mmu_swapWrite(&ku_mmu_swap_space, frame->swap, pfn);
+            ku_mmu_count(&ku_mmu_stat_swap_writes);
+        }
+        ku_mmu_slotCache(frame->swap, -1, frame->shm);
+        ku_mmu_slotPut(frame->swap);
+    }
+    if (frame->prefetched && __atomic_exchange_n(&frame->prefetched, 0, __ATOMIC_RELAXED)) {
+        ku_mmu_count(&ku_mmu_stat_prefetch_evicted);
+    }
+    frame->swap = 0;
+    frame->dirty = 0;
+    frame->shm = 0;
+    ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+    ku_mmu_bitmapFree(&ku_mmu_pmem_free_list, pfn);
+}
+
+// frees everything below table, a page table at level. swapped out tables are read back to find their slots
+void ku_mmu_free_table(ku_pte* table, int level, char pid) {
+    for (int i = 0; i < (1 << ku_mmu_LEVEL_BITS); i++) {
+        ku_mmu_entry_t entry = table[i].entry;
+        if (entry == 0) {
+            continue;
+        }
+
+        if (level == ku_mmu_LEVELS - 1) {
+            if (entry & 1) {
+                ku_mmu_free_page(ku_mmu_PTE_PFN(entry), &table[i], pid);
+            }
+            else {
+                ku_mmu_slotPut(ku_mmu_PTE_SFN(entry));
+            }
+        }
+        else if (ku_mmu_PTE_HUGE(entry)) {
+            ku_mmu_huge_free(ku_mmu_PTE_PFN(entry), pid);
+        }
+        else if (entry & 1) {
+            int pfn = ku_mmu_PTE_PFN(entry);
+            ku_mmu_free_table(ku_mmu_frame_addr(pfn), level + 1, pid);
+            ku_mmu_LOCK(&ku_mmu_policy_lock);
+            if (ku_mmu_frames[pfn].present == 0) {
+                ku_mmu_frameListRemove(&ku_mmu_idle_tables, pfn);
+            }
+            ku_mmu_frames[pfn].parent = NULL;
+            ku_mmu_frames[pfn].present = 0;
+            ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+            ku_mmu_bitmapFree(&ku_mmu_pmem_free_list, pfn);
+        }
+        else {
+            ku_pte* copy = (ku_pte*) malloc(ku_mmu_PAGE_SIZE);
+            if (copy != NULL && ku_mmu_swapRead(&ku_mmu_swap_space, ku_mmu_PTE_SFN(entry), (char*)copy) == 0) {
+                ku_mmu_free_table(copy, level + 1, pid);
+            }
+            free(copy);
+            ku_mmu_slotPut(ku_mmu_PTE_SFN(entry));
+        }
+    }
+}
+
+// releases the frames, swap slots, replacement queue entries, TLB entries and PCB of cur_node
+// caller holds the process table lock and the lock of cur_node
+void ku_mmu_release_process(ku_mmu_PCB* cur_node) {
+    ku_mmu_free_table(cur_node->pdbr, 0, cur_node->pid);
+    ku_mmu_bitmapFree(&ku_mmu_pmem_free_list, ku_mmu_table_pfn(cur_node->pdbr));
+    ku_mmu_shootdown_asid(cur_node->pid);
+    ku_mmu_LOCK(&ku_mmu_policy_lock); // the admission control reads other PCBs under it
+    if (cur_node->suspended) {
+        ku_mmu_set_suspended(cur_node, 0);
+    }
+    ku_mmu_tableRemove(&ku_mmu_running_process, cur_node);
+    if (ku_mmu_admission) { // its frames may let a suspended process run again
+        ku_mmu_admit();
+    }
+    ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+}
+
+// ends pid: its frames, swap slots, replacement queue entries, TLB entries and PCB are released
+int ku_mmu_exit(char pid) {
+    ku_mmu_LOCK(&ku_mmu_running_process.lock);
+    ku_mmu_PCB* cur_node = ku_mmu_tableSearch(&ku_mmu_running_process, pid);
+    if (cur_node == NULL || cur_node->pdbr == NULL) {
+        ku_mmu_UNLOCK(&ku_mmu_running_process.lock);
+        return -1;
+    }
+
+    ku_mmu_LOCK(&cur_node->lock);
+    ku_mmu_release_process(cur_node);
+    ku_mmu_UNLOCK(&cur_node->lock);
+    ku_mmu_UNLOCK(&ku_mmu_running_process.lock);
+    ku_mmu_count(&ku_mmu_stat_exits);
+
+    return 0;
+}
+
+// gives the empty child table dst the entries of src, a parent table at level. leaf pages end up shared
+// src is resident or a copy of a swapped out table, vpn holds the indexes of the levels above.
+// returns -1 if no frame or reverse map node is left
+int ku_mmu_fork_table(ku_pte* src, ku_pte* dst, int level, ku_mmu_vpn_t vpn, char child) {
+    if (level == ku_mmu_LEVELS - 1) {
+        int dst_pfn = ku_mmu_table_pfn(dst);
+        ku_mmu_LOCK(&ku_mmu_policy_lock); // no page of the parent is swapped out while its table is copied
+        for (int i = 0; i < (1 << ku_mmu_LEVEL_BITS); i++) {
+            ku_mmu_entry_t entry = src[i].entry;
+            if (entry == 0) {
+                continue;
+            }
+            if (entry & 1) {
+                if (ku_mmu_rmapAdd(ku_mmu_PTE_PFN(entry), &dst[i], child, (vpn << ku_mmu_LEVEL_BITS) | i) != 0) {
+                    ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+                    return -1;
+                }
+                ku_mmu_pageTableRef(dst_pfn);
+                ku_mmu_running_process.pcbs[(unsigned char)child].stat.rss++;
+            }
+            else {
+                ku_mmu_slotGet(ku_mmu_PTE_SFN(entry));
+            }
+            dst[i].entry = entry;
+        }
+        ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+        return 0;
+    }
+
+    for (int i = 0; i < (1 << ku_mmu_LEVEL_BITS); i++) {
+        ku_mmu_entry_t entry = src[i].entry;
+        ku_pte* src_table;
+        ku_pte* copy = NULL;
+        if (entry == 0) {
+            continue;
+        }
+        if (ku_mmu_PTE_HUGE(entry)) { // the child shares the small pages, copy-on-write works on those
+            ku_mmu_LOCK(&ku_mmu_policy_lock);
+            ku_mmu_huge_demote(&src[i]);
+            ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+            entry = src[i].entry;
+        }
+
+        if (entry & 1) { // held, finding frames for the child must not swap it out
+            src_table = ku_mmu_frame_addr(ku_mmu_PTE_PFN(entry));
+            ku_mmu_LOCK(&ku_mmu_policy_lock);
+            ku_mmu_pageTableRef(ku_mmu_PTE_PFN(entry));
+            ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+        }
+        else {
+            copy = (ku_pte*) malloc(ku_mmu_PAGE_SIZE);
+            if (copy == NULL || ku_mmu_swapRead(&ku_mmu_swap_space, ku_mmu_PTE_SFN(entry), (char*)copy) != 0) {
+                free(copy);
+                return -1;
+            }
+            src_table = copy;
+        }
+
+        int ret = -1;
+        int pfn = ku_mmu_get_page(child, 1);
+        if (pfn != -1) {
+            ku_mmu_zero_page(pfn);
+            ku_mmu_table_attach(pfn, &dst[i], child);
+            ret = ku_mmu_fork_table(src_table, ku_mmu_frame_addr(pfn), level + 1, (vpn << ku_mmu_LEVEL_BITS) | i, child);
+            ku_mmu_LOCK(&ku_mmu_policy_lock);
+            ku_mmu_pageTableUnref(pfn);
+            ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+        }
+        if (entry & 1) {
+            ku_mmu_LOCK(&ku_mmu_policy_lock);
+            ku_mmu_pageTableUnref(ku_mmu_PTE_PFN(entry));
+            ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+        }
+        free(copy);
+        if (ret == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// creates child_pid as a copy of parent_pid. only the page tables are copied, the pages are shared
+// until either process writes to them. -1 if the parent does not run, the child does or no frame is left
+int ku_mmu_fork(char parent_pid, char child_pid) {
+    ku_mmu_LOCK(&ku_mmu_running_process.lock);
+    ku_mmu_PCB* parent = ku_mmu_tableSearch(&ku_mmu_running_process, parent_pid);
+    if (parent == NULL || parent->pdbr == NULL || ku_mmu_tableSearch(&ku_mmu_running_process, child_pid) != NULL) {
+        ku_mmu_UNLOCK(&ku_mmu_running_process.lock);
+        return -1;
+    }
+
+    ku_mmu_LOCK(&parent->lock);
+    ku_mmu_PCB* child = ku_mmu_create_process(child_pid);
+    int ret = -1;
+    if (child != NULL) {
+        ku_mmu_LOCK(&child->lock);
+        ret = ku_mmu_fork_table(parent->pdbr, child->pdbr, 0, 0, child_pid);
+        if (ret == -1) {
+            ku_mmu_release_process(child);
+        }
+        ku_mmu_UNLOCK(&child->lock);
+    }
+    ku_mmu_UNLOCK(&parent->lock);
+    ku_mmu_UNLOCK(&ku_mmu_running_process.lock);
+
+    if (ret == 0) {
+        ku_mmu_count(&ku_mmu_stat_forks);
+    }
+    return ret;
+}
+
+// maps the page of a at va_a into b at va_b, the locks of both PCBs are held
+int ku_mmu_share_page(ku_mmu_PCB* a, ku_mmu_va_t va_a, ku_mmu_PCB* b, ku_mmu_va_t va_b) {
+    ku_pte* pte_b = ku_mmu_leaf_pte(b, va_b, 1);
+    if (pte_b == NULL) {
+        return -1;
+    }
+    ku_pte* pte_a = ku_mmu_leaf_pte(a, va_a, 1);
+    if (pte_a == NULL) {
+        ku_mmu_leaf_release(pte_b);
+        return -1;
+    }
+
+    // the page of a has to be resident and its own, a copy-on-write page is copied first
+    int ret = -1;
+    if (pte_b->entry == 0 && pte_a != pte_b && ku_mmu_populate(pte_a, a->pid, va_a, 1, 0, NULL) != -1 &&
+            (ku_mmu_writable(ku_mmu_PTE_PFN(pte_a->entry)) || ku_mmu_cow(a, pte_a, a->pid, va_a) != -1)) {
+        ku_mmu_LOCK(&ku_mmu_policy_lock);
+        ku_mmu_entry_t entry = __atomic_load_n(&pte_a->entry, __ATOMIC_ACQUIRE);
+        int pfn = ku_mmu_PTE_PFN(entry);
+        ku_mmu_frame* frame = &ku_mmu_frames[pfn];
+        // another cpu may have evicted it again. shared memory is never read-only, so shm goes first
+        if ((entry & 1) && !frame->cow) {
+            frame->shm = 1;
+        }
+        if ((entry & 1) && !frame->cow && ku_mmu_rmapAdd(pfn, pte_b, b->pid, ku_mmu_VPN(va_b)) == 0) {
+            if (frame->swap != 0) {
+                ku_mmu_slotCache(frame->swap, pfn, 1);
+            }
+            ku_mmu_pageTableRef(ku_mmu_table_pfn(pte_b));
+            ku_mmu_running_process.pcbs[(unsigned char)b->pid].stat.rss++;
+            __atomic_store_n(&pte_b->entry, ku_mmu_PTE(pfn), __ATOMIC_RELEASE);
+            ret = 0;
+        }
+        ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+    }
+    ku_mmu_leaf_release(pte_a);
+    ku_mmu_leaf_release(pte_b);
+    return ret;
+}
+
+// maps the page of pid_a at va_a into pid_b at va_b as shared memory: writes of either process are seen
+// by the other and eviction unmaps the page from both. pid_b runs from now on if it did not.
+// -1 if pid_a does not run, va_b is mapped already or no frame is left
+int ku_mmu_share(char pid_a, ku_mmu_va_t va_a, char pid_b, ku_mmu_va_t va_b) {
+    if (va_a == 0 || va_b == 0) { // never translated, same as ku_traverse
+        return -1;
+    }
+
+    ku_mmu_LOCK(&ku_mmu_running_process.lock);
+    ku_mmu_PCB* a = ku_mmu_tableSearch(&ku_mmu_running_process, pid_a);
+    ku_mmu_PCB* b = ku_mmu_tableSearch(&ku_mmu_running_process, pid_b);
+    if (a == NULL || a->pdbr == NULL) {
+        ku_mmu_UNLOCK(&ku_mmu_running_process.lock);
+        return -1;
+    }
+    if (b == NULL) {
+        b = ku_mmu_create_process(pid_b);
+        if (b == NULL) {
+            ku_mmu_UNLOCK(&ku_mmu_running_process.lock);
+            return -1;
+        }
+    }
+
+    // PCB locks are taken in pid order
+    ku_mmu_PCB* first = ((unsigned char)pid_a <= (unsigned char)pid_b)? a : b;
+    ku_mmu_PCB* second = (first == a)? b : a;
+    ku_mmu_LOCK(&first->lock);
+    if (second != first) {
+        ku_mmu_LOCK(&second->lock);
+    }
+    int ret = ku_mmu_share_page(a, va_a, b, va_b);
+    if (second != first) {
+        ku_mmu_UNLOCK(&second->lock);
+    }
+    ku_mmu_UNLOCK(&first->lock);
+    ku_mmu_UNLOCK(&ku_mmu_running_process.lock);
+
+    if (ret == 0) {
+        ku_mmu_count(&ku_mmu_stat_shares);
+    }
+    return ret;
+}
+
+int ku_mmu_alloc_physical_page() {
+    return ku_mmu_bitmapAlloc(&ku_mmu_pmem_free_list); // -1 if no free page found
+}
+
+// a free frame, or the frame of an evicted page if may_evict. -1 if none
+// pid is the process the frame is for, it is charged with the eviction
+int ku_mmu_get_page(char pid, int may_evict) {
+    ku_mmu_PCB* pcb = &ku_mmu_running_process.pcbs[(unsigned char)pid];
+    int pfn = -1;
+    if (may_evict && ku_mmu_limit(pcb) != 0 && ku_mmu_at_limit(pcb)) { // it makes room itself
+        pfn = ku_mmu_swap_out_from(pcb);
+        if (pfn != -1) {
+            ku_mmu_count(&pcb->stat.evictions_caused);
+        }
+    }
+    if (pfn == -1) {
+        pfn = ku_mmu_alloc_physical_page();
+    }
+    if (pfn == -1 && may_evict) {
+        // idle tables are cold but cheap to need again, they only go once they take more than their share
+        if (!ku_mmu_smp && ku_mmu_idle_tables.size > ku_mmu_pmem_free_list_size / ku_mmu_TABLE_SHARE) {
+            pfn = ku_mmu_reclaim_table();
+        }
+        for (int i = 0; pfn == -1 && __atomic_load_n(&ku_mmu_suspended, __ATOMIC_RELAXED) > 0 && i < ku_mmu_MAX_PROC; i++) {
+            if (ku_mmu_is_suspended((char)i)) {
+                pfn = ku_mmu_swap_out_from(&ku_mmu_running_process.pcbs[i]);
+                if (pfn != -1) {
+                    ku_mmu_count(&pcb->stat.evictions_caused);
+                }
+            }
+        }
+        if (pfn == -1) {
+            pfn = ku_mmu_swap_out();
+            if (pfn != -1) {
+                ku_mmu_count(&pcb->stat.evictions_caused);
+            }
+        }
+        if (pfn == -1) { // nothing left to evict
+            pfn = ku_mmu_reclaim_table();
+        }
+    }
+    return pfn;
+}
+
+int ku_mmu_alloc_swap_page() {
+    int slot = ku_mmu_bitmapAlloc(&ku_mmu_swap_space_free_list);
+    if (slot != -1) {
+        ku_mmu_slotInit(slot);
+        return slot;
+    }
+
+    // swap is full, take the slot of a resident page that keeps a clean copy there
+    ku_mmu_LOCK(&ku_mmu_policy_lock);
+    for (unsigned int pfn = 0; pfn < ku_mmu_pmem_free_list_size; pfn++) {
+        ku_mmu_frame* frame = &ku_mmu_frames[pfn];
+        if (frame->pte != NULL && frame->swap != 0 && ku_mmu_slotPrivate(frame->swap)) {
+            slot = frame->swap;
+            frame->swap = 0;
+            ku_mmu_slotInit(slot);
+            ku_mmu_stat_swap_steals++;
+            break;
+        }
+    }
+    ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+    return slot; // -1 if no free page found
+}
+
+// frames reused for page tables or new pages must not show what the last page left there
+void ku_mmu_zero_page(int pfn) {
+    memset((char*)ku_mmu_frame_addr(pfn), 0, ku_mmu_PAGE_SIZE);
+}
+
+int ku_mmu_swap_out() {
+    return ku_mmu_swap_out_from(NULL);
+}
+
+// evicts the victim of the replacement policy, or with owner set a page of owner's own. returns its frame
+int ku_mmu_swap_out_from(ku_mmu_PCB* owner) {
+    int new_SFN_idx = ku_mmu_alloc_swap_page();
+    if (new_SFN_idx == -1) { // in case of too small swap area was allocated
+        return -1;
+    }
+
+    ku_mmu_LOCK(&ku_mmu_policy_lock);
+    int cur_pfn = (owner == NULL)? ku_mmu_replacement->evict() : ku_mmu_local_victim(owner);
+    if (cur_pfn == -1) { // in case of too small physical memory was allocated
+        ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+        ku_mmu_slotPut(new_SFN_idx);
+        return -1;
+    }
+
+    // a clean page whose copy is still in swap goes back to that slot without a write.
+    // a dirty one may overwrite it too, unless a forked process still reads the old copy from there.
+    // shared memory always does, its mappers swapped out earlier point to that slot
+    ku_mmu_frame* target = &ku_mmu_frames[cur_pfn];
+    if (owner == NULL) {
+        ku_mmu_stat_queue_evictions++;
+    }
+    else {
+        ku_mmu_stat_local_evictions++;
+    }
+    if (target->huge) { // only its first page goes, the others stay mapped as small pages
+        ku_mmu_huge_split(cur_pfn);
+    }
+    int write = 1;
+    if (target->swap != 0 && (!target->dirty || target->shm || ku_mmu_slotPrivate(target->swap))) {
+        ku_mmu_slotPut(new_SFN_idx);
+        new_SFN_idx = target->swap;
+        write = target->dirty;
+    }
+    else if (target->swap != 0) {
+        ku_mmu_slotCache(target->swap, -1, 0);
+        ku_mmu_slotPut(target->swap);
+    }
+    ku_mmu_slotCache(new_SFN_idx, -1, target->shm);
+
+    // every mapper is unmapped in one pass, each pte holds a use of the slot
+    if (target->refs > 1) {
+        ku_mmu_stat_shared_evictions++;
+    }
+    ku_mmu_rmap_node mapper;
+    for (int n = 0; ku_mmu_rmapPop(cur_pfn, &mapper) == 0; n++) {
+        if (n > 0) {
+            ku_mmu_slotGet(new_SFN_idx);
+        }
+        ku_mmu_pageTableUnref(ku_mmu_table_pfn(mapper.pte));
+        __atomic_store_n(&mapper.pte->entry, ku_mmu_PTE_SWAP(new_SFN_idx), __ATOMIC_RELEASE);
+        ku_mmu_shootdown(mapper.pid, mapper.vpn);
+        ku_mmu_running_process.pcbs[(unsigned char)mapper.pid].stat.rss--;
+        ku_mmu_running_process.pcbs[(unsigned char)mapper.pid].stat.evictions_suffered++;
+    }
+    __atomic_store_n(&target->cow, 0, __ATOMIC_RELEASE);
+    target->shm = 0;
+    target->swap = 0;
+    if (target->prefetched && __atomic_exchange_n(&target->prefetched, 0, __ATOMIC_RELAXED)) {
+        ku_mmu_count(&ku_mmu_stat_prefetch_evicted);
+    }
+    ku_mmu_UNLOCK(&ku_mmu_policy_lock);
+    ku_mmu_count(&ku_mmu_stat_swap_outs);
+
+    // a write another cpu translated before the shootdown may have dirtied a clean page since.
+    // a page that kept a shared copy in swap is read-only, it can not have been written
+    if (ku_mmu_smp) {
+        ku_mmu_shootdown_wait();
+    }
+    write |= target->dirty;
+    target->dirty = 0;
+
+    if (write) {
+        ku_mmu_swapWrite(&ku_mmu_swap_space, new_SFN_idx, cur_pfn);
+        ku_mmu_count(&ku_mmu_stat_swap_writes);
+    }
+    else {
+        ku_mmu_count(&ku_mmu_stat_swap_clean);
+    }
+
+    return cur_pfn;
+}
+
+int ku_mmu_swap_in(ku_mmu_entry_t pte, char pid, int may_evict) {
+    unsigned int swap_space_offset = ku_mmu_PTE_SFN(pte);
+
+    int new_PFN_idx = ku_mmu_get_page(pid, may_evict);
+    if (new_PFN_idx == -1) {
+        return -1;
+    }
+    if (ku_mmu_swapRead(&ku_mmu_swap_space, swap_space_offset, (char*)ku_mmu_frame_addr(new_PFN_idx)) != 0) {
+        ku_mmu_bitmapFree(&ku_mmu_pmem_free_list, new_PFN_idx);
+        return -1;
+    }
+    ku_mmu_count(&ku_mmu_stat_swap_ins);
+
+    return new_PFN_idx;
+}
+// pages stored in the tier over their compressed size, 0 before the first one
+double ku_mmu_zswap_ratio() {
+    if (ku_mmu_stat_zswap_packed == 0) {
+        return 0;
+    }
+    return (double)ku_mmu_stat_zswap_stores * ku_mmu_PAGE_SIZE / ku_mmu_stat_zswap_packed;
+}
+
+void ku_mmu_bitmapJson(FILE* out, const char* name, ku_mmu_bitmap* pbm) {
+    fprintf(out, "    \"%s\": {\"size\": %u, \"allocs\": %llu, \"frees\": %llu, \"failures\": %llu}", name,
+        pbm->size, pbm->allocs, pbm->frees, pbm->failures);
+}
+
+// writes every counter as one JSON object. other cpus may still be running, the numbers are then a rough snapshot
+void ku_mmu_stats_json(FILE* out) {
+    fprintf(out, "{\n  \"policy\": \"%s\",\n", ku_mmu_replacement->name);
+    fprintf(out, "  \"faults\": %llu, \"swap_ins\": %llu, \"swap_outs\": %llu,\n",
+        ku_mmu_stat_faults, ku_mmu_stat_swap_ins, ku_mmu_stat_swap_outs);
+    fprintf(out, "  \"swap\": {\"writes\": %llu, \"clean_drops\": %llu, \"reads\": %llu, \"batches\": %llu, \"steals\": %llu},\n",
+        ku_mmu_stat_swap_writes, ku_mmu_stat_swap_clean, ku_mmu_stat_swap_reads, ku_mmu_stat_swap_batches,
+        ku_mmu_stat_swap_steals);
+    fprintf(out, "  \"zswap\": {\"budget\": %zu, \"bytes\": %zu, \"pages\": %u, \"stores\": %llu, \"rejects\": %llu, "
+        "\"loads\": %llu, \"writebacks\": %llu, \"ratio\": %.2f},\n", ku_mmu_zswap, ku_mmu_swap_space.tier_bytes,
+        ku_mmu_swap_space.tier_pages, ku_mmu_stat_zswap_stores, ku_mmu_stat_zswap_rejects, ku_mmu_stat_zswap_loads,
+        ku_mmu_stat_zswap_writebacks, ku_mmu_zswap_ratio());
+    fprintf(out, "  \"page_tables\": {\"outs\": %llu, \"ins\": %llu, \"idle\": %u},\n",
+        ku_mmu_stat_table_outs, ku_mmu_stat_table_ins, ku_mmu_idle_tables.size);
+    fprintf(out, "  \"prefetch\": {\"fault_around\": %llu, \"readahead\": %llu, \"used\": %llu, \"evicted\": %llu},\n",
+        ku_mmu_stat_fault_around, ku_mmu_stat_readahead, ku_mmu_stat_prefetch_used, ku_mmu_stat_prefetch_evicted);
+    fprintf(out, "  \"exits\": %llu, \"forks\": %llu,\n", ku_mmu_stat_exits, ku_mmu_stat_forks);
+    fprintf(out, "  \"cow\": {\"copies\": %llu, \"reuses\": %llu},\n", ku_mmu_stat_cow_copies, ku_mmu_stat_cow_reuses);
+    fprintf(out, "  \"rmap\": {\"shares\": %llu, \"shared_evictions\": %llu, \"nodes\": %u},\n",
+        ku_mmu_stat_shares, ku_mmu_stat_shared_evictions, ku_mmu_rmap_size);
+    fprintf(out, "  \"huge\": {\"faults\": %llu, \"collapses\": %llu, \"splits\": %llu},\n",
+        ku_mmu_stat_huge_faults, ku_mmu_stat_huge_collapses, ku_mmu_stat_huge_splits);
+    fprintf(out, "  \"resident_sets\": {\"local_evictions\": %llu, \"suspensions\": %llu, \"resumes\": %llu, "
+        "\"refused\": %llu, \"suspended\": %u},\n", ku_mmu_stat_local_evictions, ku_mmu_stat_suspensions,
+        ku_mmu_stat_resumes, ku_mmu_stat_refused, ku_mmu_suspended);
+
+    fprintf(out, "  \"allocators\": {\n");
+    ku_mmu_bitmapJson(out, "frames", &ku_mmu_pmem_free_list);
+    fprintf(out, ",\n");
+    ku_mmu_bitmapJson(out, "swap_slots", &ku_mmu_swap_space_free_list);
+    fprintf(out, "\n  },\n");
+    fprintf(out, "  \"queue\": {\"inserts\": %llu, \"evictions\": %llu, \"removes\": %llu, \"scans\": %llu},\n",
+        ku_mmu_stat_queue_inserts, ku_mmu_stat_queue_evictions, ku_mmu_stat_queue_removes, ku_mmu_stat_queue_scans);
+
+    // buckets are keyed by their lower bound in ns, empty ones are left out
+    fprintf(out, "  \"fault_latency_ns\": {\n");
+    for (int type = 0; type < ku_mmu_FAULT_TYPES; type++) {
+        ku_mmu_hist* hist = &ku_mmu_fault_latency[type];
+        const char* sep = "";
+        fprintf(out, "    \"%s\": {\"count\": %llu, \"sum\": %llu, \"buckets\": {", ku_mmu_fault_names[type],
+            hist->count, hist->sum_ns);
+        for (int i = 0; i < ku_mmu_HIST_BUCKETS; i++) {
+            if (hist->buckets[i] != 0) {
+                fprintf(out, "%s\"%llu\": %llu", sep, (i == 0)? 0ULL : 1ULL << i, hist->buckets[i]);
+                sep = ", ";
+            }
+        }
+        fprintf(out, "}}%s\n", (type == ku_mmu_FAULT_TYPES - 1)? "" : ",");
+    }
+    fprintf(out, "  },\n");
+
+    fprintf(out, "  \"processes\": [");
+    const char* sep = "\n";
+    for (int i = 0; i < ku_mmu_MAX_PROC; i++) {
+        ku_mmu_PCB* pcb = &ku_mmu_running_process.pcbs[i];
+        if (!pcb->used) {
+            continue;
+        }
+        fprintf(out, "%s    {\"pid\": %d, \"accesses\": %llu, \"minor_faults\": %llu, \"major_faults\": %llu, \"cow_faults\": %llu, "
+            "\"evictions_caused\": %llu, \"evictions_suffered\": %llu, \"rss\": %llu, \"limit\": %u, "
+            "\"suspended\": %d}", sep, pcb->pid,
+            pcb->stat.accesses, pcb->stat.minor_faults, pcb->stat.major_faults, pcb->stat.cow_faults,
+            pcb->stat.evictions_caused,
+            pcb->stat.evictions_suffered, pcb->stat.rss, ku_mmu_limit(pcb), pcb->suspended);
+        sep = ",\n";
+    }
+    fprintf(out, "%s]\n}\n", (*sep == ',')? "\n  " : "");
+}
@@ -0,0 +1,113 @@
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Binary trace format
+ * header followed by count records of pid(1) | [op(1)] | va(va_width, little endian).
+ * va_width 1 holds the signed 8-bit VAs of the text traces, 4 and 8 hold unsigned VAs.
+ * op is only present with ku_trace_OPS, without it every access is a read.
+ * the file is mapped read-only and decoded in batches, so replay does no stdio at all.
+ */
+#define ku_trace_MAGIC "KUTR"
+#define ku_trace_VERSION 1
+#define ku_trace_BATCH 4096
+#define ku_trace_OPS 0x1 // header flag, records carry an op byte
+
+#define ku_trace_READ 0
+#define ku_trace_WRITE 1
+#define ku_trace_EXIT 2 // pid exits, va is ignored
+#define ku_trace_FORK 3 // pid forks, va is the pid of the child
+#define ku_trace_SHARE 4 // page of pid at va is shared, the next record is the ku_trace_MAP target
+#define ku_trace_MAP 5 // pid maps the page of the ku_trace_SHARE record before it at va
+
+typedef struct ku_trace_header {
+    char magic[4];
+    unsigned char version;
+    unsigned char va_width;
+    unsigned char flags;
+    unsigned char reserved;
+    unsigned long long count;
+} ku_trace_header;
+
+typedef struct ku_trace {
+    unsigned char* base; // mapping of the whole file
+    size_t size;
+    const unsigned char* cur; // next record
+    unsigned long long left; // records not read yet
+    int va_width;
+    int ops;
+} ku_trace;
+
+// maps a binary trace, returns -1 if the file can not be mapped or is not a binary trace
+int ku_trace_open(ku_trace* trace, const char* path) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ku_trace_header)) {
+        close(fd);
+        return -1;
+    }
+
+    trace->size = st.st_size;
+    trace->base = (unsigned char*) mmap(NULL, trace->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (trace->base == MAP_FAILED) {
+        return -1;
+    }
+
+    ku_trace_header* header = (ku_trace_header*) trace->base;
+    int width = header->va_width;
+    if (memcmp(header->magic, ku_trace_MAGIC, 4) != 0 || header->version != ku_trace_VERSION ||
+            (width != 1 && width != 4 && width != 8) ||
+            header->count > (trace->size - sizeof(ku_trace_header)) / (1 + (header->flags & ku_trace_OPS) + width)) {
+        munmap(trace->base, trace->size);
+        return -1;
+    }
+    madvise(trace->base, trace->size, MADV_SEQUENTIAL);
+
+    trace->cur = trace->base + sizeof(ku_trace_header);
+    trace->left = header->count;
+    trace->va_width = width;
+    trace->ops = header->flags & ku_trace_OPS;
+    return 0;
+}
+
+// decodes up to max records, returns how many were read (0 at the end)
+size_t ku_trace_read(ku_trace* trace, char* pids, ku_mmu_va_t* vas, char* ops, size_t max) {
+    size_t n = (trace->left < max)? trace->left : max;
+    const unsigned char* cur = trace->cur;
+
+    if (trace->va_width == 1 && !trace->ops) {
+        for (size_t i = 0; i < n; i++, cur += 2) {
+            pids[i] = (char)cur[0];
+            vas[i] = (ku_mmu_va_t)(signed char)cur[1];
+            ops[i] = ku_trace_READ;
+        }
+    }
+    else {
+        int width = trace->va_width;
+        for (size_t i = 0; i < n; i++, cur += 1 + trace->ops + width) {
+            const unsigned char* va_bytes = cur + 1 + trace->ops;
+            unsigned long long va = 0;
+            for (int b = width - 1; b >= 0; b--) {
+                va = (va << 8) | va_bytes[b];
+            }
+            pids[i] = (char)cur[0];
+            vas[i] = (width == 1)? (ku_mmu_va_t)(signed char)va : (ku_mmu_va_t)va;
+            ops[i] = trace->ops? (char)cur[1] : ku_trace_READ;
+        }
+    }
+
+    trace->cur = cur;
+    trace->left -= n;
+    return n;
+}
+
+void ku_trace_close(ku_trace* trace) {
+    munmap(trace->base, trace->size);
+}
@@ -0,0 +1,98 @@
+/*
+ * Converts a text trace ("pid va [r|w|x|f]" per line) to the binary format of ku_trace.h
+ * op bytes are only stored when some line of the trace has an op. a share line "pid va s pid2 va2"
+ * becomes a ku_trace_SHARE record followed by a ku_trace_MAP record
+ *
+ * gcc -O2 -o ku_trace_conv ku_trace_conv.c
+ * ./ku_trace_conv <input.txt> <output.bin> [va width: 1 (default), 4 or 8]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./ku_mmu.h"
+#include "./ku_trace.h"
+
+int main(int argc, char *argv[])
+{
+	FILE *in, *out;
+	ku_trace_header header;
+	unsigned char record[10];
+	char line[128];
+	int pid, pid2, width = 1, ops = 0;
+	long long va, va2;
+	char op;
+
+	if(argc != 3 && argc != 4){
+		printf("ku_trace_conv: Wrong number of arguments\n");
+		return 1;
+	}
+	if(argc == 4){
+		width = atoi(argv[3]);
+		if(width != 1 && width != 4 && width != 8){
+			printf("ku_trace_conv: VA width must be 1, 4 or 8\n");
+			return 1;
+		}
+	}
+
+	in = fopen(argv[1], "r");
+	if(!in){
+		printf("ku_trace_conv: Fail to open the input file\n");
+		return 1;
+	}
+	out = fopen(argv[2], "wb");
+	if(!out){
+		printf("ku_trace_conv: Fail to open the output file\n");
+		fclose(in);
+		return 1;
+	}
+
+	while(fgets(line, sizeof(line), in)){
+		if(sscanf(line, "%d %lld %c", &pid, &va, &op) == 3){
+			ops = 1;
+			break;
+		}
+	}
+	rewind(in);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, ku_trace_MAGIC, 4);
+	header.version = ku_trace_VERSION;
+	header.va_width = width;
+	header.flags = ops ? ku_trace_OPS : 0;
+	fwrite(&header, sizeof(header), 1, out); /* count is patched in at the end */
+
+	while(fgets(line, sizeof(line), in)){
+		op = 'r';
+		if(sscanf(line, "%d %lld %c", &pid, &va, &op) < 2)
+			continue;
+		if(op == 's' && sscanf(line, "%*d %*d %*c %d %lld", &pid2, &va2) != 2)
+			continue;
+		record[0] = (unsigned char)pid;
+		if(ops)
+			record[1] = op == 'w' ? ku_trace_WRITE : op == 'x' ? ku_trace_EXIT : op == 'f' ? ku_trace_FORK :
+				op == 's' ? ku_trace_SHARE : ku_trace_READ;
+		for(int b = 0; b < width; b++)
+			record[1 + ops + b] = (unsigned char)((unsigned long long)va >> (8 * b));
+		fwrite(record, 1 + ops + width, 1, out);
+		header.count++;
+		if(op == 's'){
+			record[0] = (unsigned char)pid2;
+			record[1] = ku_trace_MAP;
+			for(int b = 0; b < width; b++)
+				record[2 + b] = (unsigned char)((unsigned long long)va2 >> (8 * b));
+			fwrite(record, 2 + width, 1, out);
+			header.count++;
+		}
+	}
+
+	fseek(out, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, out);
+	fclose(in);
+	if(fclose(out) != 0){
+		printf("ku_trace_conv: Fail to write the output file\n");
+		return 1;
+	}
+	printf("ku_trace_conv: %llu records\n", header.count);
+	return 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * Synthetic workload generator, writes a text trace ("pid va [r|w]" per line) to stdout
+ * every process touches pages 1..pages of its own address space, page 0 is left out so va is never 0.
+ *   uniform : every page is equally likely
+ *   zipf    : page popularity follows Zipf(theta), hot pages are scattered over the range
+ *   seq     : streams through the range touching every word of a page, wraps at the end
+ *   loop    : cycles over the first loop pages, one access per page
+ *   phase   : uniform over a working set of ws pages that moves every phase accesses
+ *   mix     : process p runs uniform, zipf, seq or loop by p % 4
+ * processes are interleaved in bursts of random length, the same seed gives the same trace.
+ *
+ * gcc -O2 -o ku_trace_gen ku_trace_gen.c
+ * ./ku_trace_gen <pattern> <accesses> <pages> [--procs=N] [--writes=PCT] [--seed=S]
+ *		[--theta=T] [--loop=L] [--ws=W] [--phase=P] [--burst=B]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "./ku_mmu.h"
+
+#define ku_gen_MAX_PROCS 127 /* positive char pids */
+
+enum { ku_gen_UNIFORM, ku_gen_ZIPF, ku_gen_SEQ, ku_gen_LOOP, ku_gen_PHASE, ku_gen_MIX };
+
+const char *ku_gen_names[] = { "uniform", "zipf", "seq", "loop", "phase", "mix" };
+
+typedef struct ku_gen_proc {
+	unsigned long long pos; /* seq: word index, loop: page index */
+	unsigned long long base; /* phase: first page of the working set */
+} ku_gen_proc;
+
+unsigned long long ku_gen_state;
+
+/* xorshift64*, independent of the libc rand() so traces are the same everywhere */
+unsigned long long ku_gen_rand()
+{
+	ku_gen_state ^= ku_gen_state >> 12;
+	ku_gen_state ^= ku_gen_state << 25;
+	ku_gen_state ^= ku_gen_state >> 27;
+	return ku_gen_state * 2685821657736338717ULL;
+}
+
+/* uniform in [0, n) */
+unsigned long long ku_gen_below(unsigned long long n)
+{
+	return ku_gen_rand() % n;
+}
+
+/* cumulative Zipf probabilities of ranks 0..pages-1 and a random rank -> page permutation */
+int ku_gen_zipf_init(double **cdf, unsigned long long **perm, unsigned long long pages, double theta)
+{
+	double sum = 0;
+
+	*cdf = malloc(pages * sizeof(double));
+	*perm = malloc(pages * sizeof(unsigned long long));
+	if(!*cdf || !*perm)
+		return -1;
+
+	for(unsigned long long i = 0; i < pages; i++){
+		sum += 1.0 / pow((double)(i + 1), theta);
+		(*cdf)[i] = sum;
+	}
+	for(unsigned long long i = 0; i < pages; i++){
+		(*cdf)[i] /= sum;
+		(*perm)[i] = i;
+	}
+	for(unsigned long long i = pages - 1; i > 0; i--){
+		unsigned long long j = ku_gen_below(i + 1), tmp = (*perm)[i];
+		(*perm)[i] = (*perm)[j];
+		(*perm)[j] = tmp;
+	}
+	return 0;
+}
+
+unsigned long long ku_gen_zipf(const double *cdf, const unsigned long long *perm, unsigned long long pages)
+{
+	double u = (ku_gen_rand() >> 11) * (1.0 / 9007199254740992.0);
+	unsigned long long lo = 0, hi = pages - 1;
+
+	while(lo < hi){
+		unsigned long long mid = lo + (hi - lo) / 2;
+		if(cdf[mid] < u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return perm[lo];
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long accesses, pages, max_pages, loop = 0, ws = 0, phase = 0;
+	unsigned long long page, offset, left = 0, words;
+	unsigned int procs = 1, writes = 0, burst = 16;
+	double theta = 0.99, *cdf = NULL;
+	unsigned long long *perm = NULL;
+	ku_gen_proc proc[ku_gen_MAX_PROCS];
+	int pattern = -1, kind, pid = 0;
+
+	if(argc < 4){
+		printf("ku_trace_gen: Wrong number of arguments\n");
+		return 1;
+	}
+	for(int i = 0; i < (int)(sizeof(ku_gen_names) / sizeof(ku_gen_names[0])); i++)
+		if(strcmp(argv[1], ku_gen_names[i]) == 0)
+			pattern = i;
+	if(pattern == -1){
+		printf("ku_trace_gen: Unknown pattern %s\n", argv[1]);
+		return 1;
+	}
+	accesses = strtoull(argv[2], NULL, 10);
+	pages = strtoull(argv[3], NULL, 10);
+	ku_gen_state = 1;
+
+	for(int i = 4; i < argc; i++){
+		if(strncmp(argv[i], "--procs=", 8) == 0) procs = strtoul(argv[i] + 8, NULL, 10);
+		else if(strncmp(argv[i], "--writes=", 9) == 0) writes = strtoul(argv[i] + 9, NULL, 10);
+		else if(strncmp(argv[i], "--seed=", 7) == 0) ku_gen_state = strtoull(argv[i] + 7, NULL, 10) | 1;
+		else if(strncmp(argv[i], "--theta=", 8) == 0) theta = strtod(argv[i] + 8, NULL);
+		else if(strncmp(argv[i], "--loop=", 7) == 0) loop = strtoull(argv[i] + 7, NULL, 10);
+		else if(strncmp(argv[i], "--ws=", 5) == 0) ws = strtoull(argv[i] + 5, NULL, 10);
+		else if(strncmp(argv[i], "--phase=", 8) == 0) phase = strtoull(argv[i] + 8, NULL, 10);
+		else if(strncmp(argv[i], "--burst=", 8) == 0) burst = strtoul(argv[i] + 8, NULL, 10);
+		else{
+			printf("ku_trace_gen: Unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	/* pages above the last one of the VA space would wrap */
+	max_pages = (1ULL << (ku_mmu_GEOMETRY - ku_mmu_PAGE_SHIFT)) - 1;
+	if(pages < 1 || pages > max_pages){
+		printf("ku_trace_gen: Pages must be between 1 and %llu\n", max_pages);
+		return 1;
+	}
+	if(procs < 1 || procs > ku_gen_MAX_PROCS || writes > 100 || burst < 1){
+		printf("ku_trace_gen: Invalid option\n");
+		return 1;
+	}
+	if(loop == 0 || loop > pages)
+		loop = pages;
+	if(ws == 0 || ws > pages)
+		ws = pages / 8 ? pages / 8 : 1;
+	if(phase == 0)
+		phase = accesses / 8 ? accesses / 8 : 1;
+	words = ku_mmu_PAGE_SIZE / 4 ? ku_mmu_PAGE_SIZE / 4 : 1;
+
+	if((pattern == ku_gen_ZIPF || pattern == ku_gen_MIX) && ku_gen_zipf_init(&cdf, &perm, pages, theta) != 0){
+		printf("ku_trace_gen: Fail to allocate the Zipf table\n");
+		return 1;
+	}
+	memset(proc, 0, sizeof(proc));
+
+	for(unsigned long long i = 0; i < accesses; i++){
+		if(left == 0){
+			pid = 1 + ku_gen_below(procs);
+			left = 1 + ku_gen_below(2 * burst - 1); /* mean burst accesses */
+		}
+		left--;
+
+		kind = pattern == ku_gen_MIX ? (pid - 1) % 4 : pattern;
+		offset = ku_gen_below(ku_mmu_PAGE_SIZE);
+		switch(kind){
+		case ku_gen_UNIFORM:
+			page = ku_gen_below(pages);
+			break;
+		case ku_gen_ZIPF:
+			page = ku_gen_zipf(cdf, perm, pages);
+			break;
+		case ku_gen_SEQ:
+			page = proc[pid - 1].pos / words % pages;
+			offset = proc[pid - 1].pos % words * 4 % ku_mmu_PAGE_SIZE;
+			proc[pid - 1].pos++;
+			break;
+		case ku_gen_LOOP:
+			page = proc[pid - 1].pos++ % loop;
+			break;
+		default:
+			if(i % phase == 0)
+				for(unsigned int p = 0; p < procs; p++)
+					proc[p].base = ku_gen_below(pages - ws + 1);
+			page = proc[pid - 1].base + ku_gen_below(ws);
+			break;
+		}
+
+		printf("%d " ku_mmu_VA_FMT, pid, (ku_mmu_va_t)((page + 1) * ku_mmu_PAGE_SIZE + offset));
+		if(writes)
+			printf(ku_gen_below(100) < writes ? " w\n" : " r\n");
+		else
+			printf("\n");
+	}
+
+	free(cdf);
+	free(perm);
+	return 0;
+}
@@ -0,0 +1,450 @@
+/*
+ * Miss ratio curve of a trace in one pass
+ * replays the page references of a trace (text or binary, see ku_trace.h) and prints the faults of LRU for
+ * every memory size at once. the stack distance of a reference (Mattson) is the number of distinct pages
+ * touched since the last reference to its page, counted with a Fenwick tree over last-reference times.
+ * the times are renumbered once they reach twice the footprint, so memory grows with the pages the trace
+ * touches and not with its length. Belady's OPT is simulated for the printed sizes from next-use distances
+ * written to an unlinked temporary file by a backward pass, read back in fixed chunks.
+ * a page is (pid, vpn). exit, fork and share records are skipped and page tables are not counted, so
+ * ku_cpu needs a few frames more than the sizes here for the same faults.
+ *
+ * gcc -O2 -o ku_trace_mrc ku_trace_mrc.c
+ * ./ku_trace_mrc <trace> [--sizes=FRAMES[,FRAMES...]] [--all] [--no-opt]
+ *   --sizes  sizes to print, powers of two up to the footprint by default
+ *   --all    LRU faults of every size from 1 to the footprint, without OPT
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./ku_mmu.h"
+#include "./ku_trace.h"
+
+#define ku_mrc_CHUNK 65536 /* references per read or write of the temporary file */
+#define ku_mrc_NEVER 0xffffffffu /* next use distance of a page that is not used again */
+#define ku_mrc_MAX_SIZES 64
+
+/* a reference in the temporary file, next is the distance to the next reference of the same page */
+typedef struct ku_mrc_ref {
+	unsigned int id;
+	unsigned int next;
+} ku_mrc_ref;
+
+/* (pid, vpn) -> page id, open addressing, ids are stored + 1 so 0 marks a free bucket */
+unsigned long long *ku_mrc_keys;
+unsigned int *ku_mrc_ids;
+size_t ku_mrc_cap;
+unsigned int ku_mrc_pages;
+
+/* stack distances: last reference time of every page, the page referenced at every time and the tree of
+ * times still holding the last reference of their page */
+unsigned int *ku_mrc_stamp;
+unsigned int *ku_mrc_who;
+unsigned int *ku_mrc_tree;
+unsigned int ku_mrc_span;
+unsigned int ku_mrc_now;
+unsigned long long *ku_mrc_hist; /* distance -> references, from 1 */
+unsigned long long ku_mrc_cold;
+
+unsigned long long ku_mrc_hash(unsigned long long key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return key;
+}
+
+/* doubles the page table and the per-page arrays, a table of cap buckets holds up to cap / 2 pages */
+int ku_mrc_grow()
+{
+	size_t cap = ku_mrc_cap ? ku_mrc_cap * 2 : 1024, old = ku_mrc_cap ? ku_mrc_cap / 2 + 1 : 0;
+	unsigned long long *keys = calloc(cap, sizeof(unsigned long long));
+	unsigned int *ids = calloc(cap, sizeof(unsigned int));
+	unsigned int *stamp = realloc(ku_mrc_stamp, (cap / 2) * sizeof(unsigned int));
+	unsigned long long *hist;
+
+	if(stamp)
+		ku_mrc_stamp = stamp;
+	hist = realloc(ku_mrc_hist, (cap / 2 + 1) * sizeof(unsigned long long));
+	if(hist)
+		ku_mrc_hist = hist;
+	if(!keys || !ids || !stamp || !hist){
+		free(keys);
+		free(ids);
+		return -1;
+	}
+	memset(ku_mrc_hist + old, 0, (cap / 2 + 1 - old) * sizeof(unsigned long long));
+
+	for(size_t i = 0; i < ku_mrc_cap; i++){
+		size_t h;
+		if(ku_mrc_ids[i] == 0)
+			continue;
+		for(h = ku_mrc_hash(ku_mrc_keys[i]) & (cap - 1); ids[h] != 0; h = (h + 1) & (cap - 1));
+		keys[h] = ku_mrc_keys[i];
+		ids[h] = ku_mrc_ids[i];
+	}
+	free(ku_mrc_keys);
+	free(ku_mrc_ids);
+	ku_mrc_keys = keys;
+	ku_mrc_ids = ids;
+	ku_mrc_cap = cap;
+	return 0;
+}
+
+/* id of the page, a page seen for the first time gets the next one and sets *fresh. -1 if memory ran out */
+long long ku_mrc_id(unsigned long long key, int *fresh)
+{
+	size_t h;
+
+	if(2 * ((size_t)ku_mrc_pages + 1) > ku_mrc_cap && ku_mrc_grow() != 0)
+		return -1;
+	for(h = ku_mrc_hash(key) & (ku_mrc_cap - 1); ku_mrc_ids[h] != 0; h = (h + 1) & (ku_mrc_cap - 1)){
+		if(ku_mrc_keys[h] == key){
+			*fresh = 0;
+			return ku_mrc_ids[h] - 1;
+		}
+	}
+	ku_mrc_keys[h] = key;
+	ku_mrc_ids[h] = ++ku_mrc_pages;
+	*fresh = 1;
+	return ku_mrc_pages - 1;
+}
+
+void ku_mrc_add(unsigned int pos, int delta)
+{
+	for(pos++; pos <= ku_mrc_span; pos += pos & -pos)
+		ku_mrc_tree[pos] += delta;
+}
+
+/* marked times up to and including pos */
+unsigned int ku_mrc_prefix(unsigned int pos)
+{
+	unsigned int sum = 0;
+
+	for(pos++; pos > 0; pos -= pos & -pos)
+		sum += ku_mrc_tree[pos];
+	return sum;
+}
+
+/* renumbers the marked times 0, 1, ... in order into a span of twice the footprint */
+int ku_mrc_compact()
+{
+	unsigned int span = ku_mrc_pages * 2 > 1024 ? ku_mrc_pages * 2 : 1024, k = 0;
+	unsigned int *who = calloc(span, sizeof(unsigned int));
+	unsigned int *tree = calloc(span + 1, sizeof(unsigned int));
+
+	if(!who || !tree){
+		free(who);
+		free(tree);
+		return -1;
+	}
+	for(unsigned int t = 0; t < ku_mrc_now; t++){
+		if(ku_mrc_who[t] == 0)
+			continue;
+		ku_mrc_stamp[ku_mrc_who[t] - 1] = k;
+		who[k++] = ku_mrc_who[t];
+	}
+	/* linear Fenwick build over the k marked positions */
+	for(unsigned int i = 1; i <= span; i++){
+		unsigned int j = i + (i & -i);
+		tree[i] += i <= k;
+		if(j <= span)
+			tree[j] += tree[i];
+	}
+	free(ku_mrc_who);
+	free(ku_mrc_tree);
+	ku_mrc_who = who;
+	ku_mrc_tree = tree;
+	ku_mrc_span = span;
+	ku_mrc_now = k;
+	return 0;
+}
+
+/* records one reference, returns the id of its page or -1 if memory ran out */
+long long ku_mrc_access(unsigned long long key)
+{
+	int fresh;
+	long long id = ku_mrc_id(key, &fresh);
+
+	if(id == -1 || (ku_mrc_now == ku_mrc_span && ku_mrc_compact() != 0))
+		return -1;
+	if(fresh)
+		ku_mrc_cold++;
+	else{
+		unsigned int last = ku_mrc_stamp[id];
+		ku_mrc_hist[ku_mrc_pages - ku_mrc_prefix(last) + 1]++;
+		ku_mrc_add(last, -1);
+		ku_mrc_who[last] = 0;
+	}
+	ku_mrc_stamp[id] = ku_mrc_now;
+	ku_mrc_who[ku_mrc_now] = id + 1;
+	ku_mrc_add(ku_mrc_now, 1);
+	ku_mrc_now++;
+	return id;
+}
+
+/* text lines are "pid va [op ...]", the binary format is decoded by ku_trace_read */
+size_t ku_mrc_read(FILE *fd, ku_trace *trace, char *pids, ku_mmu_va_t *vas, char *ops, size_t max)
+{
+	char line[128], op;
+	size_t n = 0;
+
+	if(!fd)
+		return ku_trace_read(trace, pids, vas, ops, max);
+	while(n < max && fgets(line, sizeof(line), fd)){
+		op = 'r';
+		if(sscanf(line, ku_mmu_TRACE_SCN " %c", &pids[n], &vas[n], &op) < 2)
+			continue;
+		ops[n++] = op == 'w' ? ku_trace_WRITE : op == 'r' ? ku_trace_READ : ku_trace_EXIT;
+	}
+	return n;
+}
+
+/* the backward pass: turns the page ids of the file into ids with next-use distances */
+int ku_mrc_next_use(int tmp, unsigned long long count)
+{
+	unsigned long long *last = malloc((size_t)(ku_mrc_pages ? ku_mrc_pages : 1) * sizeof(unsigned long long));
+	ku_mrc_ref *refs = malloc(ku_mrc_CHUNK * sizeof(ku_mrc_ref));
+	unsigned long long end = count;
+
+	if(!last || !refs){
+		free(last);
+		free(refs);
+		return -1;
+	}
+	for(unsigned int i = 0; i < ku_mrc_pages; i++)
+		last[i] = count;
+	while(end > 0){
+		unsigned long long begin = end > ku_mrc_CHUNK ? end - ku_mrc_CHUNK : 0;
+		size_t size = (end - begin) * sizeof(ku_mrc_ref);
+		if(pread(tmp, refs, size, begin * sizeof(ku_mrc_ref)) != (ssize_t)size)
+			break;
+		for(unsigned long long i = end; i-- > begin;){
+			ku_mrc_ref *ref = &refs[i - begin];
+			unsigned long long dist = last[ref->id] - i;
+			ref->next = (last[ref->id] == count || dist >= ku_mrc_NEVER) ? ku_mrc_NEVER : dist;
+			last[ref->id] = i;
+		}
+		if(pwrite(tmp, refs, size, begin * sizeof(ku_mrc_ref)) != (ssize_t)size)
+			break;
+		end = begin;
+	}
+	free(last);
+	free(refs);
+	return end == 0 ? 0 : -1;
+}
+
+/* max-heap of the resident pages by next use, pos maps a page to its heap index or -1 */
+void ku_mrc_sift(unsigned int *heap, int *pos, unsigned long long *next, unsigned int n, unsigned int i)
+{
+	unsigned int id = heap[i];
+
+	while(i > 0 && next[heap[(i - 1) / 2]] < next[id]){
+		heap[i] = heap[(i - 1) / 2];
+		pos[heap[i]] = i;
+		i = (i - 1) / 2;
+	}
+	for(;;){
+		unsigned int c = 2 * i + 1;
+		if(c >= n)
+			break;
+		if(c + 1 < n && next[heap[c + 1]] > next[heap[c]])
+			c++;
+		if(next[heap[c]] <= next[id])
+			break;
+		heap[i] = heap[c];
+		pos[heap[i]] = i;
+		i = c;
+	}
+	heap[i] = id;
+	pos[id] = i;
+}
+
+/* faults of Belady's OPT with frames frames, replaying the file of the backward pass. -1 on failure */
+long long ku_mrc_opt(int tmp, unsigned long long count, unsigned int frames)
+{
+	unsigned int *heap = malloc((size_t)frames * sizeof(unsigned int)), n = 0;
+	int *pos = malloc((size_t)ku_mrc_pages * sizeof(int));
+	unsigned long long *next = malloc((size_t)ku_mrc_pages * sizeof(unsigned long long));
+	ku_mrc_ref *refs = malloc(ku_mrc_CHUNK * sizeof(ku_mrc_ref));
+	long long faults = 0;
+
+	if(!heap || !pos || !next || !refs)
+		faults = -1;
+	for(unsigned int i = 0; faults == 0 && i < ku_mrc_pages; i++)
+		pos[i] = -1;
+	for(unsigned long long begin = 0; faults != -1 && begin < count; begin += ku_mrc_CHUNK){
+		unsigned long long len = count - begin < ku_mrc_CHUNK ? count - begin : ku_mrc_CHUNK;
+		if(pread(tmp, refs, len * sizeof(ku_mrc_ref), begin * sizeof(ku_mrc_ref)) != (ssize_t)(len * sizeof(ku_mrc_ref))){
+			faults = -1;
+			break;
+		}
+		for(unsigned long long i = 0; i < len; i++){
+			unsigned int id = refs[i].id;
+			next[id] = refs[i].next == ku_mrc_NEVER ? ~0ULL : begin + i + refs[i].next;
+			if(pos[id] != -1){
+				ku_mrc_sift(heap, pos, next, n, pos[id]);
+				continue;
+			}
+			faults++;
+			if(n == frames){ /* the page used farthest in the future goes */
+				pos[heap[0]] = -1;
+				heap[0] = heap[--n];
+				if(n > 0)
+					ku_mrc_sift(heap, pos, next, n, 0);
+			}
+			heap[n++] = id;
+			ku_mrc_sift(heap, pos, next, n, n - 1);
+		}
+	}
+	free(heap);
+	free(pos);
+	free(next);
+	free(refs);
+	return faults;
+}
+
+/* "64,128,1000" -> sizes, returns how many were parsed or -1 */
+int ku_mrc_sizes(const char *arg, unsigned long long *sizes)
+{
+	int n = 0;
+	char *end;
+
+	while(*arg){
+		if(n == ku_mrc_MAX_SIZES)
+			return -1;
+		sizes[n] = strtoull(arg, &end, 10);
+		if(end == arg || sizes[n] == 0)
+			return -1;
+		n++;
+		if(*end == ',')
+			end++;
+		else if(*end)
+			return -1;
+		arg = end;
+	}
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *fd = NULL;
+	ku_trace trace;
+	char pids[ku_trace_BATCH], ops[ku_trace_BATCH];
+	ku_mmu_va_t vas[ku_trace_BATCH];
+	ku_mrc_ref *refs = NULL;
+	unsigned long long sizes[ku_mrc_MAX_SIZES], count = 0, tail = 0, faults;
+	int nsizes = 0, all = 0, opt = 1, tmp = -1, error = 0;
+	size_t n, nrefs = 0;
+
+	if(argc < 2){
+		printf("ku_trace_mrc: Wrong number of arguments\n");
+		return 1;
+	}
+	for(int i = 2; i < argc; i++){
+		if(strncmp(argv[i], "--sizes=", 8) == 0) nsizes = ku_mrc_sizes(argv[i] + 8, sizes);
+		else if(strcmp(argv[i], "--all") == 0) all = 1;
+		else if(strcmp(argv[i], "--no-opt") == 0) opt = 0;
+		else{
+			printf("ku_trace_mrc: Unknown option %s\n", argv[i]);
+			return 1;
+		}
+		if(nsizes < 0){
+			printf("ku_trace_mrc: Invalid size list\n");
+			return 1;
+		}
+	}
+	opt = opt && !all;
+
+	if(ku_trace_open(&trace, argv[1]) != 0){
+		fd = fopen(argv[1], "r");
+		if(!fd){
+			printf("ku_trace_mrc: Fail to open the input file\n");
+			return 1;
+		}
+	}
+	if(opt){
+		char path[] = "/tmp/ku_mrc.XXXXXX";
+		tmp = mkstemp(path);
+		if(tmp != -1)
+			unlink(path);
+		refs = malloc(ku_mrc_CHUNK * sizeof(ku_mrc_ref));
+		if(tmp == -1 || !refs){
+			printf("ku_trace_mrc: Fail to create the temporary file\n");
+			return 1;
+		}
+	}
+
+	while(!error && (n = ku_mrc_read(fd, &trace, pids, vas, ops, ku_trace_BATCH)) > 0){
+		for(size_t i = 0; i < n && !error; i++){
+			long long id;
+			if(ops[i] != ku_trace_READ && ops[i] != ku_trace_WRITE)
+				continue;
+			id = ku_mrc_access((unsigned long long)(unsigned char)pids[i] << 56 | ku_mmu_VPN(vas[i]));
+			error = id == -1;
+			count++;
+			if(opt && !error){
+				refs[nrefs].id = id;
+				refs[nrefs++].next = 0;
+				if(nrefs == ku_mrc_CHUNK){
+					error = write(tmp, refs, nrefs * sizeof(ku_mrc_ref)) != (ssize_t)(nrefs * sizeof(ku_mrc_ref));
+					nrefs = 0;
+				}
+			}
+		}
+	}
+	if(opt && !error && nrefs > 0)
+		error = write(tmp, refs, nrefs * sizeof(ku_mrc_ref)) != (ssize_t)(nrefs * sizeof(ku_mrc_ref));
+	free(refs);
+	if(fd)
+		fclose(fd);
+	else
+		ku_trace_close(&trace);
+	if(!error && opt)
+		error = ku_mrc_next_use(tmp, count) != 0;
+	if(error){
+		printf("ku_trace_mrc: Fail to process the trace\n");
+		return 1;
+	}
+
+	printf("ku_trace_mrc: %llu references, %u pages\n", count, ku_mrc_pages);
+	for(unsigned int d = 1; d <= ku_mrc_pages; d++)
+		tail += ku_mrc_hist[d];
+	if(all){
+		printf("%12s %14s %9s\n", "frames", "lru faults", "lru miss");
+		for(unsigned int m = 1; m <= ku_mrc_pages; m++){
+			tail -= ku_mrc_hist[m];
+			printf("%12u %14llu %8.4f%%\n", m, ku_mrc_cold + tail, 100.0 * (ku_mrc_cold + tail) / count);
+		}
+		return 0;
+	}
+
+	if(nsizes == 0)
+		for(unsigned long long m = 1; nsizes < ku_mrc_MAX_SIZES && m < 2ULL * ku_mrc_pages; m *= 2)
+			sizes[nsizes++] = m < ku_mrc_pages ? m : ku_mrc_pages;
+	printf("%12s %14s %9s", "frames", "lru faults", "lru miss");
+	if(opt)
+		printf(" %14s %9s", "opt faults", "opt miss");
+	printf("\n");
+	for(int s = 0; s < nsizes; s++){
+		unsigned long long m = sizes[s];
+		faults = ku_mrc_cold;
+		for(unsigned long long d = m + 1; d <= ku_mrc_pages; d++)
+			faults += ku_mrc_hist[d];
+		printf("%12llu %14llu %8.4f%%", m, faults, count ? 100.0 * faults / count : 0.0);
+		if(opt){
+			long long best = m >= ku_mrc_pages ? (long long)ku_mrc_cold : ku_mrc_opt(tmp, count, m);
+			if(best == -1){
+				printf("\nku_trace_mrc: Fail to simulate OPT\n");
+				return 1;
+			}
+			printf(" %14lld %8.4f%%", best, count ? 100.0 * best / count : 0.0);
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+	if(tmp != -1)
+		close(tmp);
+	return 0;
+}
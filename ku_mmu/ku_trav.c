@@ -0,0 +1,31 @@
+/*
+ * Page walk of the 8-bit layout, source of the prebuilt ku_trav.o
+ * VA is PD(2) | PMD(2) | PT(2) | offset(2), every entry is a char of PFN(6) | unused(1) | present(1).
+ * returns the physical address, or 0 when va is 0 or an entry on the path is not present.
+ */
+
+int ku_traverse(void *ku_cr3, char va, void *pmem)
+{
+	char pd_idx = (va & 0xc0) >> 6;
+	char pmd_idx = (va & 0x30) >> 4;
+	char pt_idx = (va & 0x0c) >> 2;
+	unsigned char offset = va & 0x03;
+	char *entry;
+
+	if(va == 0)
+		return 0;
+
+	entry = (char *)ku_cr3 + pd_idx;
+	if(!(*entry & 1) || (*entry & 2))
+		return 0;
+
+	entry = (char *)pmem + (((*entry & 0xfc) >> 2) << 2) + pmd_idx;
+	if(!(*entry & 1) || (*entry & 2))
+		return 0;
+
+	entry = (char *)pmem + (((*entry & 0xfc) >> 2) << 2) + pt_idx;
+	if(!(*entry & 1) || (*entry & 2))
+		return 0;
+
+	return (unsigned char)((*entry & 0xfc) + offset);
+}